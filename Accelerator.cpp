@@ -0,0 +1,310 @@
+#include "Accelerator.h"
+
+#include <chrono>
+
+#include "BVH8.h"
+#include "BVHCache.h"
+#include "Grid.h"
+
+AccelOptions::AccelOptions()
+{
+    bvhMethod = BVH_BINNED;
+    splitBudget = -1;
+    optimizePasses = 0;
+    layout = BVH_LAYOUT_DFS;
+#if defined(__x86_64__) && defined(__linux__)
+    bvhWidth = 8;
+#else
+    bvhWidth = 2;
+#endif
+    traversal = BVH_TRAVERSE_STACK;
+    compress = false;
+    sceneFile = NULL;
+    useCache = false;
+}
+
+void Accelerator::firstHits(RayPacket& packet)
+{
+    for (int i = 0; i < packet.size; i++) {
+        Ray4 ray = packet.ray(i);
+        if (firstHit(ray, *packet.hit[i], packet.tmax[i])) {
+            packet.tmax[i] = packet.hit[i]->t;
+            packet.status[i] = PACKET_HIT;
+        }
+    }
+}
+
+static double millisSince(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double, milli>(
+               chrono::steady_clock::now() - start).count();
+}
+
+/////////////////////////////////////////////////////////////////////////
+//
+// "brute": tests every object.  The reference the others are checked
+// against, and the fastest choice for a handful of objects.
+//
+/////////////////////////////////////////////////////////////////////////
+class BruteForceAccelerator : public Accelerator {
+public:
+    BruteForceAccelerator() : objects(NULL) {}
+
+    const char *getName() const {return "brute";};
+
+    void build(vector<Object*>& objs) {
+        objects = &objs;
+        update();
+    };
+
+    // Compile the objects anew, in an order grouped by type
+    void update() {
+        grouped = *objects;
+        if (!grouped.empty())
+            PrimitiveList::groupByType(&grouped[0], (int)grouped.size());
+        primList.compile(grouped.empty() ? NULL : &grouped[0],
+                         (int)grouped.size());
+    };
+
+    bool firstHit(Ray4& ray, Hit& hit, float tmax) {
+        Hit h;
+        traversal.rays++;
+        traversal.prims += grouped.size();
+        if (grouped.empty())
+            return false;
+        SphereRay sphereRay(ray);
+        return primList.firstHit(&grouped[0], 0, (int)grouped.size(), ray,
+                                 sphereRay, h, hit, tmax);
+    };
+
+    bool anyHit(Ray4& ray, float tmin, float tmax) {
+        traversal.rays++;
+        if (grouped.empty())
+            return false;
+        SphereRay sphereRay(ray);
+        int tested = 0;
+        bool found = primList.occludes(&grouped[0], 0, (int)grouped.size(),
+                                       ray, sphereRay, tmin, tmax, tested);
+        traversal.prims += tested;
+        return found;
+    };
+
+    double buildMillis() const {return 0;};
+
+    size_t memoryBytes() const {
+        return grouped.size() * sizeof(Object*) + primList.memoryBytes();
+    };
+
+    void resetTraversalStats() {traversal.reset();};
+    TraversalStats traversalStats() const {return traversal;};
+
+    void printStats(ostream& os) const {
+        os << "Brute force: " << objects->size() << " objects";
+        if (primList.sphereCount() > 0)
+            os << ", " << primList.sphereCount() << " spheres tested by the "
+               << sphereKernelName() << " kernel";
+        os << endl;
+    };
+
+private:
+    vector<Object*> *objects;
+    vector<Object*> grouped;    // the objects, spheres first, then triangles
+    PrimitiveList primList;
+    TraversalStats traversal;
+};
+
+/////////////////////////////////////////////////////////////////////////
+//
+// "bvh": the binary hierarchy, traced as it is or collapsed to
+// 8-wide nodes, and optionally kept in an on-disk cache
+//
+/////////////////////////////////////////////////////////////////////////
+class BVHAccelerator : public Accelerator {
+public:
+    BVHAccelerator(const AccelOptions& opts) : options(opts), millis(0) {
+        if (options.splitBudget >= 0)
+            bvh.setSplitBudget(options.splitBudget);
+        bvh.setOptimizePasses(options.optimizePasses);
+        bvh.setLayout(options.layout);
+        bvh.setTraversal(options.traversal);
+
+        // The 8-wide kernels keep a full stack
+        if (options.traversal != BVH_TRAVERSE_STACK)
+            options.bvhWidth = 2;
+    };
+
+    const char *getName() const {return "bvh";};
+
+    void build(vector<Object*>& objects) {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        if (options.useCache && options.sceneFile != NULL) {
+            BVHCache cache(options.sceneFile, options.cacheDir,
+                           options.bvhMethod, bvh.getSplitBudget(),
+                           options.optimizePasses, options.layout);
+            if (!cache.load(bvh, objects)) {
+                bvh.build(objects, options.bvhMethod);
+                if (!cache.save(bvh, objects))
+                    cerr << "Can't write " << cache.getPath() << endl;
+            }
+        }
+        else
+            bvh.build(objects, options.bvhMethod);
+        if (options.bvhWidth == 8)
+            bvh8.collapse(bvh, options.compress);
+        millis = millisSince(start);
+    };
+
+    void update() {
+        if (bvh.update())
+            bvh.printStats(cerr);
+        if (options.bvhWidth == 8)
+            bvh8.collapse(bvh, options.compress);
+    };
+
+    bool firstHit(Ray4& ray, Hit& hit, float tmax) {
+        if (options.bvhWidth == 8)
+            return bvh8.firstHit(ray, hit, tmax);
+        return bvh.firstHit(ray, hit, tmax);
+    };
+
+    // Packets always walk the binary tree
+    void firstHits(RayPacket& packet) {bvh.firstHits(packet);};
+
+    bool anyHit(Ray4& ray, float tmin, float tmax) {
+        if (options.bvhWidth == 8)
+            return bvh8.anyHit(ray, tmin, tmax);
+        return bvh.anyHit(ray, tmin, tmax);
+    };
+
+    double buildMillis() const {return millis;};
+
+    size_t memoryBytes() const {
+        if (options.bvhWidth == 8)
+            return bvh8.nodeBytes() + bvh.getPrims().size() * sizeof(Object*);
+        return bvh.memoryBytes();
+    };
+
+    void resetTraversalStats() {
+        bvh.resetTraversalStats();
+        bvh8.resetTraversalStats();
+    };
+
+    TraversalStats traversalStats() const {
+        if (options.bvhWidth != 8)
+            return bvh.traversalStats();
+
+        // Packets are counted by the binary tree
+        TraversalStats stats = bvh8.traversalStats();
+        stats.rays += bvh.traversalStats().rays;
+        stats.nodes += bvh.traversalStats().nodes;
+        stats.prims += bvh.traversalStats().prims;
+        return stats;
+    };
+
+    void printStats(ostream& os) const {
+        bvh.printStats(os);
+        if (options.bvhWidth == 8)
+            bvh8.printStats(os);
+        if (bvh.degradation() != 1)
+            os << "BVH: refit since the last build, SAH cost now "
+               << bvh.degradation() << "x" << endl;
+    };
+
+private:
+    AccelOptions options;
+    BVH bvh;
+    BVH8 bvh8;
+    double millis;
+};
+
+/////////////////////////////////////////////////////////////////////////
+//
+// "grid": a uniform grid, rebuilt whenever the objects move
+//
+/////////////////////////////////////////////////////////////////////////
+class GridAccelerator : public Accelerator {
+public:
+    GridAccelerator() : objects(NULL) {}
+
+    const char *getName() const {return "grid";};
+
+    void build(vector<Object*>& objs) {
+        objects = &objs;
+        grid.build(objs);
+    };
+
+    void update() {grid.build(*objects);};
+
+    bool firstHit(Ray4& ray, Hit& hit, float tmax) {
+        return grid.firstHit(ray, hit, tmax);
+    };
+
+    bool anyHit(Ray4& ray, float tmin, float tmax) {
+        return grid.anyHit(ray, tmin, tmax);
+    };
+
+    double buildMillis() const {return grid.getBuildMillis();};
+    size_t memoryBytes() const {return grid.memoryBytes();};
+
+    void resetTraversalStats() {grid.resetTraversalStats();};
+    TraversalStats traversalStats() const {return grid.traversalStats();};
+
+    void printStats(ostream& os) const {grid.printStats(os);};
+
+private:
+    vector<Object*> *objects;
+    Grid grid;
+};
+
+static Accelerator *createBruteForce(const AccelOptions&)
+{
+    return new BruteForceAccelerator();
+}
+
+static Accelerator *createBVH(const AccelOptions& options)
+{
+    return new BVHAccelerator(options);
+}
+
+static Accelerator *createGrid(const AccelOptions&)
+{
+    return new GridAccelerator();
+}
+
+//
+// The registered backends.  A new one needs a class above (or in a
+// file of its own) and a line here.
+//
+struct AcceleratorEntry {
+    const char *name;
+    Accelerator *(*create)(const AccelOptions& options);
+};
+
+static const AcceleratorEntry accelerators[] = {
+    {"bvh",   createBVH},
+    {"grid",  createGrid},
+    {"brute", createBruteForce},
+};
+
+static const int ACCELERATOR_COUNT =
+    sizeof(accelerators) / sizeof(accelerators[0]);
+
+Accelerator *createAccelerator(const string& name,
+                               const AccelOptions& options)
+{
+    for (int i = 0; i < ACCELERATOR_COUNT; i++)
+        if (name == accelerators[i].name)
+            return accelerators[i].create(options);
+    return NULL;
+}
+
+string acceleratorNames()
+{
+    string names;
+    for (int i = 0; i < ACCELERATOR_COUNT; i++) {
+        if (i > 0)
+            names += "|";
+        names += accelerators[i].name;
+    }
+    return names;
+}
@@ -0,0 +1,107 @@
+#if !defined(_ACCELERATOR_H_)
+
+#define _ACCELERATOR_H_
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "BVH.h"
+#include "GeomLib.h"
+#include "Hit.h"
+#include "Object.h"
+#include "TraversalStats.h"
+
+//
+// Settings a backend may use when it builds; each one reads only
+// those that concern it.
+//
+struct AccelOptions {
+    BVHBuildMethod bvhMethod;   // bvh: how the binary tree is built
+    float splitBudget;          //      (BVH_SBVH) duplicate references
+    int optimizePasses;         //      treelet passes after each build
+    BVHLayout layout;           //      node order
+    int bvhWidth;               //      2 or 8: which tree is traced
+    BVHTraversal traversal;     //      how the binary tree is walked
+                                //      (all but the stack: width 2)
+    bool compress;              //      quantized 8-wide nodes
+
+    const char *sceneFile;      // bvh: the scene, to key the cache
+    bool useCache;              //      load/save the built tree
+    string cacheDir;            //      where (empty: next to the scene)
+
+    AccelOptions();
+};
+
+//
+// An acceleration structure: finds what a ray hits among the scene
+// objects.  Backends are created by name (see createAccelerator()), so
+// that rt can switch between them with --accel=<name>.
+//
+class Accelerator {
+public:
+    virtual ~Accelerator() {}
+
+    // The name it is registered under
+    virtual const char *getName() const = 0;
+
+    //
+    // Build over "objects", which must outlive the accelerator
+    //
+    virtual void build(vector<Object*>& objects) = 0;
+
+    //
+    // Call after the objects have moved.  Refits or rebuilds.
+    //
+    virtual void update() = 0;
+
+    //
+    // Find the closest object hit by "ray" with t < tmax.
+    // If there is one, fill in "hit" and return true.
+    //
+    virtual bool firstHit(Ray4& ray, Hit& hit, float tmax) = 0;
+
+    //
+    // firstHit() for every ray of "packet" (see RayPacket.h), leaving
+    // it to packet.record() to make any hit records still pending.
+    // The default traces the rays one at a time.
+    //
+    virtual void firstHits(RayPacket& packet);
+
+    //
+    // true iff "ray" hits anything with tmin <= t < tmax: the query
+    // for shadow rays.  Stops at the first object found, and fills in
+    // no hit record.
+    //
+    virtual bool anyHit(Ray4& ray, float tmin, float tmax) = 0;
+
+    //
+    // Time taken by the last build (or update), and bytes held
+    //
+    virtual double buildMillis() const = 0;
+    virtual size_t memoryBytes() const = 0;
+
+    //
+    // Rays, node visits and primitive tests since the last reset
+    //
+    virtual void resetTraversalStats() = 0;
+    virtual TraversalStats traversalStats() const = 0;
+
+    //
+    // Print the backend's own description of what it built
+    //
+    virtual void printStats(ostream& os) const = 0;
+};
+
+//
+// The backend registered as "name", or NULL if there is none
+//
+Accelerator *createAccelerator(const string& name,
+                               const AccelOptions& options);
+
+//
+// The registered names, separated by '|'
+//
+string acceleratorNames();
+
+#endif
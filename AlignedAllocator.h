@@ -0,0 +1,60 @@
+#if !defined(_ALIGNED_ALLOCATOR_H_)
+
+#define _ALIGNED_ALLOCATOR_H_
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+#if defined(_WIN32)
+#include <malloc.h>
+#endif
+
+//
+// Allocator for vectors whose storage must start on an "Alignment"-byte
+// boundary (a power of two, at least sizeof(void*)): hierarchy nodes
+// are laid out so that siblings share a cache line, which only holds
+// if the array itself starts on one.
+//
+template <class T, size_t Alignment>
+struct AlignedAllocator {
+    typedef T value_type;
+
+    template <class U>
+    struct rebind {typedef AlignedAllocator<U, Alignment> other;};
+
+    AlignedAllocator() {}
+    template <class U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+    T *allocate(size_t n) {
+        void *p = NULL;
+#if defined(_WIN32)
+        p = _aligned_malloc(n * sizeof(T), Alignment);
+#else
+        if (posix_memalign(&p, Alignment, n * sizeof(T)) != 0)
+            p = NULL;
+#endif
+        if (p == NULL)
+            throw std::bad_alloc();
+        return (T *)p;
+    };
+
+    void deallocate(T *p, size_t) {
+#if defined(_WIN32)
+        _aligned_free(p);
+#else
+        free(p);
+#endif
+    };
+};
+
+template <class T, class U, size_t Alignment>
+bool operator==(const AlignedAllocator<T, Alignment>&,
+                const AlignedAllocator<U, Alignment>&) {return true;}
+
+template <class T, class U, size_t Alignment>
+bool operator!=(const AlignedAllocator<T, Alignment>&,
+                const AlignedAllocator<U, Alignment>&) {return false;}
+
+#endif
@@ -0,0 +1,31 @@
+#include "BBox.h"
+
+//
+// Explicit constructor, from two opposite corners
+//
+BBox::BBox(const Point4& p, const Point4& q)
+{
+    for (int a = 0; a < 3; a++) {
+        lo[a] = fminf(p[a], q[a]);
+        hi[a] = fmaxf(p[a], q[a]);
+    }
+}
+
+void BBox::grow(const Point4& p)
+{
+    for (int a = 0; a < 3; a++) {
+        lo[a] = fminf(lo[a], p[a]);
+        hi[a] = fmaxf(hi[a], p[a]);
+    }
+}
+
+int BBox::maxExtent() const
+{
+    float dx = hi[0] - lo[0];
+    float dy = hi[1] - lo[1];
+    float dz = hi[2] - lo[2];
+
+    if (dx > dy && dx > dz)
+        return 0;
+    return (dy > dz) ? 1 : 2;
+}
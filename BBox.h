@@ -0,0 +1,92 @@
+#if !defined(_BBOX_H_)
+
+#define _BBOX_H_
+
+#include <cfloat>
+
+#include "GeomLib.h"
+
+//
+// An axis-aligned bounding box, stored as its two extreme corners.
+// A default-constructed box is empty: growing it by a point or a box
+// gives exactly that point or box.
+//
+// The small methods are defined here so that the builders' inner
+// loops can inline them.
+//
+class BBox {
+public:
+    //
+    // Default constructor: the empty box
+    //
+    inline BBox() {
+        lo[0] = lo[1] = lo[2] =  FLT_MAX;
+        hi[0] = hi[1] = hi[2] = -FLT_MAX;
+    };
+
+    //
+    // Explicit constructor, from two opposite corners
+    //
+    BBox(const Point4& lo, const Point4& hi);
+
+    //
+    // Enlarge this box so that it also contains "p"
+    //
+    void grow(const Point4& p);
+
+    //
+    // Enlarge this box so that it also contains "other"
+    //
+    inline void grow(const BBox& other) {
+        for (int a = 0; a < 3; a++) {
+            lo[a] = (other.lo[a] < lo[a]) ? other.lo[a] : lo[a];
+            hi[a] = (other.hi[a] > hi[a]) ? other.hi[a] : hi[a];
+        }
+    };
+
+    //
+    // Shrink this box to its overlap with "other"; if they do not
+    // overlap, it becomes the empty box
+    //
+    inline void clip(const BBox& other) {
+        for (int a = 0; a < 3; a++) {
+            lo[a] = (other.lo[a] > lo[a]) ? other.lo[a] : lo[a];
+            hi[a] = (other.hi[a] < hi[a]) ? other.hi[a] : hi[a];
+        }
+        if (lo[0] > hi[0] || lo[1] > hi[1] || lo[2] > hi[2])
+            *this = BBox();
+    };
+
+    //
+    // true iff nothing was ever added to this box
+    //
+    inline bool isEmpty() const {return lo[0] > hi[0];};
+
+    //
+    // Total area of the six faces (0 for an empty box)
+    //
+    inline float surfaceArea() const {
+        if (isEmpty())
+            return 0;
+        float dx = hi[0] - lo[0];
+        float dy = hi[1] - lo[1];
+        float dz = hi[2] - lo[2];
+        return 2 * (dx*dy + dy*dz + dz*dx);
+    };
+
+    //
+    // Midpoint of the box along one axis (0=X, 1=Y, 2=Z)
+    //
+    inline float center(int axis) const {return 0.5f * (lo[axis] + hi[axis]);};
+
+    //
+    // The axis (0, 1 or 2) along which the box is longest
+    //
+    int maxExtent() const;
+
+    // The two corners
+    float lo[3];
+    float hi[3];
+};
+
+#endif
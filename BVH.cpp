@@ -0,0 +1,903 @@
+#include "BVH.h"
+#include "RayQuery.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <chrono>
+#include <functional>
+#include <thread>
+#include <unordered_set>
+
+// Relative costs of one traversal step and one primitive test,
+// as used by the surface area heuristic.
+static const float TRAVERSAL_COST = 1.0f;
+static const float INTERSECT_COST = 1.0f;
+
+// Leaves never hold more primitives than this.
+static const int MAX_LEAF_SIZE = 8;
+
+// Below this depth the builder stops trusting the SAH and splits at
+// the median, so the tree depth (and the traversal stack) stays bounded.
+static const int MEDIAN_SPLIT_DEPTH = 40;
+
+// Deep enough for any tree the builders make; linear BVHs over many
+// duplicate Morton codes are the deepest (up to 63 + 31 levels).
+static const int STACK_SIZE = 128;
+
+// Entries of the short stack (BVH_TRAVERSE_SHORT_STACK)
+static const int SHORT_STACK_SIZE = 4;
+
+// By default, update() rebuilds once refitting has made the tree
+// 50% more expensive to trace than a fresh one.
+static const float DEFAULT_REBUILD_THRESHOLD = 1.5f;
+
+// Candidate split planes per axis for the binned builder
+static const int BIN_COUNT = 32;
+
+// Subtrees with at least this many primitives may be handed to
+// a worker thread by the binned builder.
+static const int PARALLEL_THRESHOLD = 4096;
+
+// By default, spatial splits may add 30% more references than
+// there are primitives.
+static const float DEFAULT_SPLIT_BUDGET = 0.3f;
+
+// Orders build references by centroid along one axis
+struct CentroidLess {
+    int axis;
+    CentroidLess(int a) : axis(a) {}
+    bool operator()(const BVHBuildRef& a, const BVHBuildRef& b) const {
+        return a.c[axis] < b.c[axis];
+    }
+};
+
+static const char *methodName(BVHBuildMethod method)
+{
+    switch (method) {
+    case BVH_SWEEP:  return "sweep";
+    case BVH_BINNED: return "binned";
+    case BVH_LBVH:   return "lbvh";
+    case BVH_SBVH:   return "sbvh";
+    }
+    return "?";
+}
+
+BVH::BVH() {
+    method = BVH_BINNED;
+    buildMillis = 0;
+    loaded = false;
+    builtCost = 0;
+    rebuildThreshold = DEFAULT_REBUILD_THRESHOLD;
+    splitBudget = DEFAULT_SPLIT_BUDGET;
+    optimizePasses = 0;
+    layout = BVH_LAYOUT_BUILD;
+    walk = BVH_TRAVERSE_STACK;
+    unoptimizedCost = 0;
+    optimizeMillis = 0;
+    objectCount = 0;
+}
+
+/////////////////////////////////////////////////////////////////////////
+// Build the hierarchy over "objects"
+/////////////////////////////////////////////////////////////////////////
+void BVH::build(vector<Object*>& objects, BVHBuildMethod how)
+{
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    method = how;
+    loaded = false;
+    unoptimizedCost = 0;
+    optimizeMillis = 0;
+    nodes.clear();
+    prims.clear();
+    parents.clear();
+    objectCount = (int)objects.size();
+
+    if (objects.empty()) {
+        primList.compile(NULL, 0);
+        buildMillis = 0;
+        return;
+    }
+
+    int n = (int)objects.size();
+
+    BVHBuildState state;
+    state.refs.resize(n);
+    for (int i = 0; i < n; i++) {
+        BVHBuildRef& ref = state.refs[i];
+        ref.box = objects[i]->bounds();
+        for (int a = 0; a < 3; a++)
+            ref.c[a] = ref.box.center(a);
+        ref.index = i;
+    }
+
+    // The root sits alone at index 0; index 1 is padding so that every
+    // pair of siblings starts on an even index.  A binary tree over n
+    // primitives has at most 2n-1 nodes, so 2n slots always suffice.
+    nodes.resize(2 * n);
+    state.nextNode = 2;
+    state.threads = 0;
+    state.maxThreads = max(1, (int)thread::hardware_concurrency());
+
+    if (how == BVH_SWEEP)
+        buildSweep(state, 0, n, 0, 0);
+    else if (how == BVH_LBVH)
+        buildLinear(state);
+    else if (how == BVH_SBVH) {
+        // Every reference a split adds may cost two more nodes.  The
+        // builder puts the leaf references back into state.refs.
+        state.objects = &objects[0];
+        state.splitBudget = (int)(splitBudget * n);
+        nodes.resize(2 * (n + state.splitBudget));
+
+        vector<BVHBuildRef> refs;
+        refs.swap(state.refs);
+        buildSpatial(state, refs, 0, 0);
+    }
+    else
+        buildBinned(state, 0, n, 0, 0);
+
+    nodes.resize(state.nextNode);
+
+    prims.resize(state.refs.size());
+    for (int i = 0; i < (int)prims.size(); i++)
+        prims[i] = objects[state.refs[i].index];
+
+    buildMillis = chrono::duration<double, milli>(
+                      chrono::steady_clock::now() - start).count();
+    builtCost = sahCost();
+
+    optimize(optimizePasses);
+    reorder(layout);
+    linkParents();
+    groupLeaves();
+}
+
+/////////////////////////////////////////////////////////////////////////
+// Take over a saved hierarchy, after checking that it is a tree, that
+// every reference is in range and that every object is referenced, so
+// that a damaged cache can only cost a rebuild
+/////////////////////////////////////////////////////////////////////////
+bool BVH::load(vector<Object*>& objects, const BVHNode *savedNodes,
+               int nodeCount, const int *order, int primCount,
+               BVHBuildMethod how)
+{
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    nodes.clear();
+    prims.clear();
+    objectCount = 0;
+    unoptimizedCost = 0;
+    optimizeMillis = 0;
+
+    int n = (int)objects.size();
+    if (n == 0 || nodeCount < 1 || primCount < n)
+        return false;
+
+    // Walk the tree from the root: every node must be reached exactly
+    // once, and no deeper than the traversal stack allows
+    vector<bool> reached(nodeCount, false);
+    vector<pair<int, int> > stack(1, make_pair(0, 0));
+    int reachedCount = 0;
+    while (!stack.empty()) {
+        int index = stack.back().first;
+        int depth = stack.back().second;
+        stack.pop_back();
+        if (reached[index] || depth >= STACK_SIZE)
+            return false;
+        reached[index] = true;
+        reachedCount++;
+
+        const BVHNode& node = savedNodes[index];
+        if (node.isLeaf()) {
+            if (node.first < 0 || node.first > primCount - node.count)
+                return false;
+        }
+        else {
+            if (node.count < 0 || node.first < 2 ||
+                node.first >= nodeCount - 1 || node.first % 2 != 0)
+                return false;
+            stack.push_back(make_pair(node.first, depth + 1));
+            stack.push_back(make_pair(node.first + 1, depth + 1));
+        }
+    }
+    if (reachedCount != nodeCount - (nodeCount > 1 ? 1 : 0))
+        return false;
+
+    vector<bool> seen(n, false);
+    int distinct = 0;
+    for (int i = 0; i < primCount; i++) {
+        if (order[i] < 0 || order[i] >= n)
+            return false;
+        if (!seen[order[i]]) {
+            seen[order[i]] = true;
+            distinct++;
+        }
+    }
+    if (distinct != n)
+        return false;
+
+    nodes.assign(savedNodes, savedNodes + nodeCount);
+    prims.resize(primCount);
+    for (int i = 0; i < primCount; i++)
+        prims[i] = objects[order[i]];
+    objectCount = n;
+    method = how;
+    loaded = true;
+    linkParents();
+    groupLeaves();
+
+    buildMillis = chrono::duration<double, milli>(
+                      chrono::steady_clock::now() - start).count();
+    builtCost = sahCost();
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////////////
+// Put each leaf's spheres first and its triangles next, so that they
+// are tested in one run each, and compile the references
+/////////////////////////////////////////////////////////////////////////
+void BVH::groupLeaves()
+{
+    for (int i = 0; i < (int)nodes.size(); i++)
+        if (nodes[i].isLeaf())
+            PrimitiveList::groupByType(&prims[nodes[i].first], nodes[i].count);
+    primList.compile(&prims[0], (int)prims.size());
+}
+
+void BVH::setTraversal(BVHTraversal t)
+{
+    walk = t;
+    linkParents();
+}
+
+/////////////////////////////////////////////////////////////////////////
+// Record the parent of every sibling pair, for the traversals that
+// climb back up the tree; the others don't keep them
+/////////////////////////////////////////////////////////////////////////
+void BVH::linkParents()
+{
+    if (walk == BVH_TRAVERSE_STACK || nodes.empty()) {
+        vector<int>().swap(parents);
+        return;
+    }
+
+    parents.assign((nodes.size() + 1) / 2, -1);
+    vector<int> todo(1, 0);
+    while (!todo.empty()) {
+        int index = todo.back();
+        todo.pop_back();
+        const BVHNode& node = nodes[index];
+        if (node.isLeaf())
+            continue;
+        parents[node.first / 2] = index;
+        todo.push_back(node.first);
+        todo.push_back(node.first + 1);
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////
+// Refit after objects have moved, or rebuild if refitting has made
+// the tree too much worse than a fresh one
+/////////////////////////////////////////////////////////////////////////
+bool BVH::update()
+{
+    if (nodes.empty())
+        return false;
+
+    refit();
+    if (degradation() <= rebuildThreshold)
+        return false;
+
+    // Spatial splits reference some objects more than once
+    vector<Object*> objects;
+    objects.reserve(objectCount);
+    unordered_set<Object*> seen;
+    for (int i = 0; i < (int)prims.size(); i++)
+        if (objectCount == (int)prims.size() || seen.insert(prims[i]).second)
+            objects.push_back(prims[i]);
+
+    build(objects, method);
+    return true;
+}
+
+void BVH::refit()
+{
+    if (nodes.empty())
+        return;
+    refitNode(0);
+    primList.compile(&prims[0], (int)prims.size());
+}
+
+// Leaves take the union of their objects' bounds, interior
+// nodes the union of their children's.  (Objects that a spatial split
+// had clipped get their whole bounds back.)
+BBox BVH::refitNode(int nodeIndex)
+{
+    BVHNode& node = nodes[nodeIndex];
+    BBox box;
+
+    if (node.isLeaf()) {
+        for (int i = node.first; i < node.first + node.count; i++)
+            box.grow(prims[i]->bounds());
+    }
+    else {
+        box = refitNode(node.first);
+        box.grow(refitNode(node.first + 1));
+    }
+
+    node.box = box;
+    return box;
+}
+
+/////////////////////////////////////////////////////////////////////////
+// SAH cost of the whole tree: the area of each node relative to the
+// root is the chance that a ray through the root also enters it.
+/////////////////////////////////////////////////////////////////////////
+float BVH::sahCost() const
+{
+    if (nodes.empty())
+        return 0;
+
+    double cost = 0;
+    for (int i = 0; i < (int)nodes.size(); i++) {
+        if (i == 1)
+            continue;       // padding, not a node
+        const BVHNode& node = nodes[i];
+        if (node.isLeaf())
+            cost += INTERSECT_COST * node.count * node.box.surfaceArea();
+        else
+            cost += TRAVERSAL_COST * node.box.surfaceArea();
+    }
+
+    float rootArea = nodes[0].box.surfaceArea();
+    return (rootArea > 0) ? (float)(cost / rootArea) : 0;
+}
+
+float BVH::degradation() const
+{
+    return (builtCost > 0) ? sahCost() / builtCost : 1;
+}
+
+void BVH::printStats(ostream& os) const
+{
+    os << "BVH: " << methodName(method)
+       << (loaded ? " build (cached) of " : " build of ")
+       << objectCount << " primitives, ";
+    if ((int)prims.size() != objectCount)
+        os << prims.size() << " references, ";
+    os << nodes.size() << " nodes, "
+       << buildMillis << (loaded ? " ms to load" : " ms")
+       << ", SAH cost " << builtCost;
+    if (unoptimizedCost > 0)
+        os << " (" << unoptimizedCost << " before treelet optimization, "
+           << optimizeMillis << " ms)";
+    os << endl;
+    if (walk != BVH_TRAVERSE_STACK)
+        os << "BVH: "
+           << (walk == BVH_TRAVERSE_STACKLESS ? "stackless" : "short-stack")
+           << " traversal, " << parents.size() * sizeof(int) / 1024.0
+           << " KB of parent links" << endl;
+    if (primList.sphereCount() > 0)
+        os << "BVH: " << primList.sphereCount()
+           << " sphere references in the leaves, " << sphereKernelName()
+           << " kernel" << endl;
+}
+
+void BVH::makeLeaf(int nodeIndex, int begin, int end)
+{
+    nodes[nodeIndex].first = begin;
+    nodes[nodeIndex].count = end - begin;
+}
+
+void BVH::makeInner(BVHBuildState& state, int nodeIndex)
+{
+    nodes[nodeIndex].first = state.nextNode.fetch_add(2);
+    nodes[nodeIndex].count = 0;
+}
+
+/////////////////////////////////////////////////////////////////////////
+// Full-sweep SAH build: for each axis, sort the primitives by centroid
+// and evaluate every split position between them.
+/////////////////////////////////////////////////////////////////////////
+void BVH::buildSweep(BVHBuildState& state, int begin, int end,
+                     int nodeIndex, int depth)
+{
+    vector<BVHBuildRef>& refs = state.refs;
+    int n = end - begin;
+
+    BBox box;
+    for (int i = begin; i < end; i++)
+        box.grow(refs[i].box);
+    nodes[nodeIndex].box = box;
+
+    if (n == 1) {
+        makeLeaf(nodeIndex, begin, end);
+        return;
+    }
+
+    int mid = begin + n/2;
+
+    if (depth < MEDIAN_SPLIT_DEPTH) {
+        float bestCost = FLT_MAX;
+        int bestAxis = -1;
+        int bestSplit = 0;
+        vector<float> rightArea(n);
+
+        for (int axis = 0; axis < 3; axis++) {
+            sort(refs.begin() + begin, refs.begin() + end, CentroidLess(axis));
+
+            // rightArea[i] = area of the box around primitives i .. n-1
+            BBox right;
+            for (int i = n - 1; i > 0; i--) {
+                right.grow(refs[begin + i].box);
+                rightArea[i] = right.surfaceArea();
+            }
+
+            BBox left;
+            for (int i = 1; i < n; i++) {
+                left.grow(refs[begin + i - 1].box);
+                float cost = i * left.surfaceArea() + (n - i) * rightArea[i];
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestSplit = i;
+                }
+            }
+        }
+
+        float area = box.surfaceArea();
+        float leafCost = INTERSECT_COST * n;
+        float splitCost = (area > 0)
+            ? TRAVERSAL_COST + INTERSECT_COST * bestCost / area
+            : leafCost;
+
+        if (n <= MAX_LEAF_SIZE && splitCost >= leafCost) {
+            makeLeaf(nodeIndex, begin, end);
+            return;
+        }
+
+        // The refs are still sorted along Z from the last sweep
+        if (bestAxis != 2)
+            sort(refs.begin() + begin, refs.begin() + end, CentroidLess(bestAxis));
+        mid = begin + bestSplit;
+    }
+    else {
+        nth_element(refs.begin() + begin, refs.begin() + mid,
+                    refs.begin() + end, CentroidLess(box.maxExtent()));
+    }
+
+    makeInner(state, nodeIndex);
+    int children = nodes[nodeIndex].first;
+
+    buildSweep(state, begin, mid, children,     depth + 1);
+    buildSweep(state, mid,   end, children + 1, depth + 1);
+}
+
+// Bin of a centroid coordinate, given the binning origin and scale
+static inline int binOf(float c, float lo, float scale, int bins)
+{
+    int b = (int)((c - lo) * scale);
+    return min(b, bins - 1);
+}
+
+/////////////////////////////////////////////////////////////////////////
+// Drop the centroids of refs[0 .. n-1] into the bins set up in
+// "binning", and evaluate the SAH at the planes between bins.
+// Fills in the best split found, if any.
+/////////////////////////////////////////////////////////////////////////
+void BVH::findObjectSplit(const BVHBuildRef *refs, int n, BVHBinning& binning)
+{
+    int bins = binning.bins;
+    BBox binBox[3][BIN_COUNT];
+    int binCount[3][BIN_COUNT] = {{0}};
+
+    for (int i = 0; i < n; i++) {
+        for (int a = 0; a < 3; a++) {
+            int b = binOf(refs[i].c[a], binning.lo[a], binning.scale[a], bins);
+            binBox[a][b].grow(refs[i].box);
+            binCount[a][b]++;
+        }
+    }
+
+    binning.cost = FLT_MAX;
+    binning.axis = -1;
+
+    for (int a = 0; a < 3; a++) {
+        if (binning.scale[a] == 0)
+            continue;
+
+        // Sweep from the right, then from the left; the plane
+        // "b" separates bins 0 .. b-1 from bins b .. bins-1.
+        BBox rightBox[BIN_COUNT];
+        int rightCount[BIN_COUNT];
+        BBox right;
+        int count = 0;
+        for (int b = bins - 1; b > 0; b--) {
+            right.grow(binBox[a][b]);
+            count += binCount[a][b];
+            rightBox[b] = right;
+            rightCount[b] = count;
+        }
+
+        BBox left;
+        count = 0;
+        for (int b = 1; b < bins; b++) {
+            left.grow(binBox[a][b-1]);
+            count += binCount[a][b-1];
+            if (count == 0 || rightCount[b] == 0)
+                continue;
+            float cost = count * left.surfaceArea()
+                       + rightCount[b] * rightBox[b].surfaceArea();
+            if (cost < binning.cost) {
+                binning.cost = cost;
+                binning.axis = a;
+                binning.bin = b;
+                binning.left = left;
+                binning.right = rightBox[b];
+            }
+        }
+    }
+}
+
+// Move the references that go left under the split in "binning" to
+// the front; returns how many there are
+int BVH::partitionObjects(BVHBuildRef *refs, int n, const BVHBinning& binning)
+{
+    int axis = binning.axis;
+    int split = binning.bin;
+    int bins = binning.bins;
+    float lo = binning.lo[axis];
+    float s = binning.scale[axis];
+    return (int)(partition(refs, refs + n,
+                           [=](const BVHBuildRef& r) {
+                               return binOf(r.c[axis], lo, s, bins) < split;
+                           }) - refs);
+}
+
+/////////////////////////////////////////////////////////////////////////
+// Binned SAH build: drop the centroids into BIN_COUNT equal slices of
+// their bounds along each axis, and evaluate only the planes between
+// slices (fewer slices for small nodes, where most would stay empty).
+// Large subtrees are built on worker threads.
+/////////////////////////////////////////////////////////////////////////
+void BVH::buildBinned(BVHBuildState& state, int begin, int end,
+                      int nodeIndex, int depth)
+{
+    vector<BVHBuildRef>& refs = state.refs;
+    int n = end - begin;
+
+    // Bounds of the primitives, and of their centroids
+    BBox box;
+    float clo[3] = { FLT_MAX,  FLT_MAX,  FLT_MAX};
+    float chi[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+    for (int i = begin; i < end; i++) {
+        box.grow(refs[i].box);
+        for (int a = 0; a < 3; a++) {
+            float c = refs[i].c[a];
+            clo[a] = (c < clo[a]) ? c : clo[a];
+            chi[a] = (c > chi[a]) ? c : chi[a];
+        }
+    }
+    nodes[nodeIndex].box = box;
+
+    if (n == 1) {
+        makeLeaf(nodeIndex, begin, end);
+        return;
+    }
+
+    BVHBinning binning;
+    binning.bins = min(BIN_COUNT, 2 * n);
+    for (int a = 0; a < 3; a++) {
+        float extent = chi[a] - clo[a];
+        binning.lo[a] = clo[a];
+        binning.scale[a] = (extent > 0) ? binning.bins * 0.99999f / extent : 0;
+    }
+    binning.axis = -1;
+
+    if (depth < MEDIAN_SPLIT_DEPTH) {
+        findObjectSplit(&refs[begin], n, binning);
+
+        float area = box.surfaceArea();
+        float leafCost = INTERSECT_COST * n;
+        float splitCost = (binning.axis >= 0 && area > 0)
+            ? TRAVERSAL_COST + INTERSECT_COST * binning.cost / area
+            : leafCost;
+
+        if (n <= MAX_LEAF_SIZE && splitCost >= leafCost) {
+            makeLeaf(nodeIndex, begin, end);
+            return;
+        }
+    }
+
+    int mid;
+    if (binning.axis >= 0)
+        mid = begin + partitionObjects(&refs[begin], n, binning);
+    else {
+        // Too deep, or all centroids coincide: split at the median
+        mid = begin + n/2;
+        nth_element(refs.begin() + begin, refs.begin() + mid,
+                    refs.begin() + end, CentroidLess(box.maxExtent()));
+    }
+
+    makeInner(state, nodeIndex);
+    int children = nodes[nodeIndex].first;
+
+    if (n >= PARALLEL_THRESHOLD &&
+        state.threads.fetch_add(1) < state.maxThreads - 1) {
+        thread worker(&BVH::buildBinned, this, std::ref(state),
+                      begin, mid, children, depth + 1);
+        buildBinned(state, mid, end, children + 1, depth + 1);
+        worker.join();
+        state.threads--;
+    }
+    else {
+        if (n >= PARALLEL_THRESHOLD)
+            state.threads--;
+        buildBinned(state, begin, mid, children,     depth + 1);
+        buildBinned(state, mid,   end, children + 1, depth + 1);
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////
+// Slab test of a ray (origin "org", reciprocal direction "inv") against
+// a box.  On a hit in [0, tmax], sets tEnter and returns true.
+/////////////////////////////////////////////////////////////////////////
+static inline bool hitsBox(const BBox& box, const float org[3],
+                           const float inv[3], float tmax, float& tEnter)
+{
+    float t0 = 0;
+    float t1 = tmax;
+
+    for (int a = 0; a < 3; a++) {
+        float tNear = (box.lo[a] - org[a]) * inv[a];
+        float tFar  = (box.hi[a] - org[a]) * inv[a];
+        if (tNear > tFar)
+            swap(tNear, tFar);
+
+        // Widen the far plane by a few ulps so that flat boxes around
+        // axis-aligned triangles are not missed through rounding.
+        tFar *= 1.0000004f;
+
+        // Written so that a NaN (0 * inf) leaves the interval unchanged
+        t0 = tNear > t0 ? tNear : t0;
+        t1 = tFar  < t1 ? tFar  : t1;
+        if (t0 > t1)
+            return false;
+    }
+
+    tEnter = t0;
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////////////
+// Find the closest object hit by the ray with t < tmax
+/////////////////////////////////////////////////////////////////////////
+bool BVH::firstHit(Ray4& ray, Hit& hit, float tmax)
+{
+    ClosestHitQuery query(hit);
+    if (walk == BVH_TRAVERSE_SHORT_STACK)
+        return traverseShortStack(ray, query, tmax, SHORT_STACK_SIZE);
+    if (walk == BVH_TRAVERSE_STACKLESS)
+        return traverseShortStack(ray, query, tmax, 0);
+    return traverseStack(ray, query, tmax);
+}
+
+/////////////////////////////////////////////////////////////////////////
+// Is anything hit with tmin <= t < tmax?
+/////////////////////////////////////////////////////////////////////////
+bool BVH::anyHit(Ray4& ray, float tmin, float tmax)
+{
+    AnyHitQuery query(tmin);
+    if (walk == BVH_TRAVERSE_SHORT_STACK)
+        return traverseShortStack(ray, query, tmax, SHORT_STACK_SIZE);
+    if (walk == BVH_TRAVERSE_STACKLESS)
+        return traverseShortStack(ray, query, tmax, 0);
+    return traverseStack(ray, query, tmax);
+}
+
+/////////////////////////////////////////////////////////////////////////
+// Walk the tree with a stack deep enough for any tree, for "query"
+// (see RayQuery.h) up to tmax
+/////////////////////////////////////////////////////////////////////////
+template <class Query>
+bool BVH::traverseStack(Ray4& ray, Query& query, float tmax)
+{
+    if (nodes.empty())
+        return false;
+
+    float org[3], inv[3];
+    for (int a = 0; a < 3; a++) {
+        org[a] = ray.start[a];
+        inv[a] = 1.0f / ray.direction[a];
+    }
+
+    SphereRay sphereRay(ray);
+    traversal.rays++;
+
+    float tEnter;
+    if (!hitsBox(nodes[0].box, org, inv, tmax, tEnter))
+        return false;
+
+    int   stack[STACK_SIZE];
+    float stackT[STACK_SIZE];
+    int sp = 0;
+
+    bool found = false;
+    int node = 0;
+    int visited = 0;
+    int tested = 0;
+
+    for (;;) {
+        const BVHNode& n = nodes[node];
+        visited++;
+
+        if (n.isLeaf()) {
+            if (queryLeaf(query, primList, &prims[0], n.first, n.count,
+                          ray, sphereRay, tmax, tested)) {
+                found = true;
+                if (Query::anyHit)
+                    break;
+            }
+        }
+        else {
+            float tl, tr;
+            bool hl = hitsBox(nodes[n.first].box,     org, inv, tmax, tl);
+            bool hr = hitsBox(nodes[n.first + 1].box, org, inv, tmax, tr);
+
+            if (hl && hr) {
+                // Visit the nearer child first, come back for the other
+                int nearChild = (tl <= tr) ? n.first : n.first + 1;
+                stack[sp] = (tl <= tr) ? n.first + 1 : n.first;
+                if (!Query::anyHit)
+                    stackT[sp] = (tl <= tr) ? tr : tl;
+                sp++;
+                node = nearChild;
+                continue;
+            }
+            if (hl) {
+                node = n.first;
+                continue;
+            }
+            if (hr) {
+                node = n.first + 1;
+                continue;
+            }
+        }
+
+        // Pop the next subtree that is still closer than the best hit
+        while (!Query::anyHit && sp > 0 && stackT[sp - 1] >= tmax)
+            sp--;
+        if (sp == 0)
+            break;
+        node = stack[--sp];
+    }
+
+    traversal.nodes += visited;
+    traversal.prims += tested;
+    return found;
+}
+
+/////////////////////////////////////////////////////////////////////////
+// traverseStack() with a ring of "capacity" stack entries (0: none).  When
+// the ring is full, a new far child overwrites the oldest entry.  Once
+// the ring runs dry after that, the subtrees it lost hang off the path
+// from the root to the current node, so climbing that path finds them:
+// at each parent, if the node came from the near child and the far one
+// is still hit, the far one is next.  Near and far are decided as on
+// the way down, from the box entry distances, which don't depend on
+// tmax; a box missed on the way down stays missed as tmax shrinks.
+/////////////////////////////////////////////////////////////////////////
+template <class Query>
+bool BVH::traverseShortStack(Ray4& ray, Query& query, float tmax,
+                             int capacity)
+{
+    if (nodes.empty())
+        return false;
+
+    float org[3], inv[3];
+    for (int a = 0; a < 3; a++) {
+        org[a] = ray.start[a];
+        inv[a] = 1.0f / ray.direction[a];
+    }
+
+    SphereRay sphereRay(ray);
+    traversal.rays++;
+
+    float tEnter;
+    if (!hitsBox(nodes[0].box, org, inv, tmax, tEnter))
+        return false;
+
+    int   stack[SHORT_STACK_SIZE];
+    float stackT[SHORT_STACK_SIZE];
+    int top = 0;            // where the next entry goes
+    int held = 0;           // entries in the ring
+    bool dropped = false;   // an entry was overwritten: climb when dry
+
+    bool found = false;
+    int node = 0;
+    int visited = 0;
+    int tested = 0;
+
+    for (;;) {
+        const BVHNode& n = nodes[node];
+        visited++;
+
+        if (n.isLeaf()) {
+            if (queryLeaf(query, primList, &prims[0], n.first, n.count,
+                          ray, sphereRay, tmax, tested)) {
+                found = true;
+                if (Query::anyHit)
+                    break;
+            }
+        }
+        else {
+            float tl = 0, tr = 0;
+            bool hl = hitsBox(nodes[n.first].box,     org, inv, tmax, tl);
+            bool hr = hitsBox(nodes[n.first + 1].box, org, inv, tmax, tr);
+
+            if (hl && hr) {
+                int nearChild = (tl <= tr) ? n.first : n.first + 1;
+                if (capacity > 0) {
+                    stack[top] = (tl <= tr) ? n.first + 1 : n.first;
+                    if (!Query::anyHit)
+                        stackT[top] = (tl <= tr) ? tr : tl;
+                    top = (top + 1 == capacity) ? 0 : top + 1;
+                    if (held < capacity)
+                        held++;
+                    else
+                        dropped = true;
+                }
+                node = nearChild;
+                continue;
+            }
+            if (hl) {
+                node = n.first;
+                continue;
+            }
+            if (hr) {
+                node = n.first + 1;
+                continue;
+            }
+        }
+
+        // Pop the next subtree that is still closer than the best hit
+        bool popped = false;
+        while (held > 0 && !popped) {
+            top = (top == 0) ? capacity - 1 : top - 1;
+            held--;
+            if (Query::anyHit || stackT[top] < tmax) {
+                node = stack[top];
+                popped = true;
+            }
+        }
+        if (popped)
+            continue;
+
+        if (capacity > 0 && !dropped)
+            break;
+
+        // Climb to the first far sibling not yet visited
+        bool descend = false;
+        while (node != 0 && !descend) {
+            int sibling = node ^ 1;
+            float tn, ts;
+            visited++;
+            if (hitsBox(nodes[sibling].box, org, inv, tmax, ts) &&
+                hitsBox(nodes[node].box, org, inv, tmax, tn) &&
+                ((node < sibling) ? tn <= ts : tn < ts)) {
+                node = sibling;
+                descend = true;
+            }
+            else
+                node = parents[node / 2];
+        }
+        if (!descend)
+            break;
+    }
+
+    traversal.nodes += visited;
+    traversal.prims += tested;
+    return found;
+}
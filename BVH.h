@@ -0,0 +1,310 @@
+#if !defined(_BVH_H_)
+
+#define _BVH_H_
+
+#include <atomic>
+#include <iostream>
+#include <vector>
+
+#include "AlignedAllocator.h"
+#include "BBox.h"
+#include "GeomLib.h"
+#include "Hit.h"
+#include "Object.h"
+#include "PrimitiveList.h"
+#include "TraversalStats.h"
+
+//
+// One node of the hierarchy: 32 bytes, so two siblings share a
+// 64-byte cache line.  An interior node has count == 0 and its two
+// children at nodes[first] and nodes[first+1].  A leaf references
+// the count primitives prims[first] .. prims[first+count-1].
+//
+struct BVHNode {
+    BBox box;
+    int first;
+    int count;
+
+    inline bool isLeaf() const {return count > 0;};
+};
+
+// Node storage: starts on a cache line, so every sibling pair fills one
+typedef vector<BVHNode, AlignedAllocator<BVHNode, 64> > BVHNodeArray;
+
+//
+// A primitive as seen by the builders: its box, the centroid of
+// that box and its position in the caller's object list.
+//
+struct BVHBuildRef {
+    BBox box;
+    float c[3];
+    int index;
+};
+
+//
+// How the hierarchy is built.  All but BVH_LBVH are top-down surface
+// area heuristic (SAH) builders:
+//   BVH_SWEEP  evaluates every split between sorted centroids
+//              (O(n log^2 n), single-threaded)
+//   BVH_BINNED evaluates a fixed set of candidate planes per axis
+//              and builds large subtrees on worker threads
+//   BVH_LBVH   sorts the centroids along a Morton curve and emits
+//              the tree in one parallel pass (fastest build, for
+//              scenes that change every frame; slower to trace)
+//   BVH_SBVH   binned, plus spatial splits that cut large primitives
+//              and reference them on both sides (best trees for
+//              long, thin triangles; single-threaded)
+//
+enum BVHBuildMethod {BVH_SWEEP, BVH_BINNED, BVH_LBVH, BVH_SBVH};
+
+//
+// The order of the nodes in memory; the tree itself is the same.  Each
+// sibling pair (one cache line) stays together, and the pairs are
+// placed:
+//   BVH_LAYOUT_BUILD  as the builder allocated them
+//   BVH_LAYOUT_DFS    depth first, the children of the larger (by
+//                     surface area) sibling right after their parents
+//   BVH_LAYOUT_VEB    van Emde Boas: the top half of the levels, then
+//                     each subtree hanging below them, each laid out
+//                     the same way (cache-oblivious)
+//
+enum BVHLayout {BVH_LAYOUT_BUILD, BVH_LAYOUT_DFS, BVH_LAYOUT_VEB};
+
+//
+// How firstHit() and anyHit() find their way back to the far children it skipped:
+//   BVH_TRAVERSE_STACK       a stack deep enough for any tree (1 KB
+//                            per ray)
+//   BVH_TRAVERSE_SHORT_STACK a few entries; when they overflow, the
+//                            oldest is dropped and found again later
+//                            by climbing the parent links
+//   BVH_TRAVERSE_STACKLESS   no stack: after each subtree it climbs
+//                            the parent links to the next far child,
+//                            testing siblings' boxes again on the way
+// The last two keep the per-ray state in a few registers, at the cost
+// of a parent link per sibling pair and of some repeated box tests.
+//
+enum BVHTraversal {BVH_TRAVERSE_STACK, BVH_TRAVERSE_SHORT_STACK,
+                   BVH_TRAVERSE_STACKLESS};
+
+//
+// Centroid binning of a set of build references along all three axes,
+// and the best object split it finds: references whose centroids fall
+// in bins below "bin" on "axis" go left.  axis == -1: no split.
+//
+struct BVHBinning {
+    int bins;
+    float lo[3];        // centroid bounds, low corner
+    float scale[3];     // bins per unit length (0: all centroids equal)
+
+    float cost;         // count * area of both sides, summed
+    int axis;
+    int bin;
+    BBox left, right;   // boxes of the two sides
+};
+
+//
+// Working data shared by all threads of one build.
+//
+struct BVHBuildState {
+    vector<BVHBuildRef> refs;
+    atomic<int> nextNode;   // first free slot in nodes[]
+    atomic<int> threads;    // worker threads currently running
+    int maxThreads;
+
+    // Spatial splits only
+    Object * const *objects; // the caller's list, to clip primitives
+    int splitBudget;         // references the splits may still add
+    float minOverlap;        // smallest child overlap worth splitting
+};
+
+//
+// Bounding volume hierarchy over the scene objects.
+//
+class BVH {
+public:
+    BVH();
+
+    //
+    // Build the hierarchy over "objects".  The hierarchy keeps its own
+    // (reordered) copy of the pointers; the objects must outlive it.
+    //
+    void build(vector<Object*>& objects, BVHBuildMethod method = BVH_BINNED);
+
+    //
+    // Take over a hierarchy built earlier over the same "objects"
+    // (see BVHCache): "order" lists the leaf references as indices
+    // into "objects".  Returns false, leaving the hierarchy empty, if
+    // the arrays don't describe a tree over all of "objects".
+    //
+    bool load(vector<Object*>& objects, const BVHNode *nodes, int nodeCount,
+              const int *order, int primCount, BVHBuildMethod method);
+
+    //
+    // Find the closest object hit by "ray" with t < tmax.
+    // If there is one, fill in "hit" and return true.
+    //
+    bool firstHit(Ray4& ray, Hit& hit, float tmax);
+
+    //
+    // firstHit() for every ray of "packet", the rays walking the tree
+    // together (see BVHPacket.cpp).  Packets whose rays point into
+    // different octants are traced one ray at a time.
+    //
+    void firstHits(RayPacket& packet);
+
+    //
+    // true iff "ray" hits anything with tmin <= t < tmax.  Stops at
+    // the first such object, and fills in no hit record.
+    //
+    bool anyHit(Ray4& ray, float tmin, float tmax);
+
+    //
+    // Rearrange small treelets of the built tree to lower its SAH
+    // cost, for up to "passes" rounds (fewer if a round gains little).
+    // Slower than any build; pays off for scenes traced many times.
+    //
+    void optimize(int passes);
+
+    //
+    // Reorder the nodes of the built tree into "layout"
+    //
+    void reorder(BVHLayout layout);
+
+    //
+    // Make build() (and so update()'s rebuilds) reorder every tree it
+    // builds into this layout (default BVH_LAYOUT_BUILD: as built)
+    //
+    void setLayout(BVHLayout l) {layout = l;};
+    BVHLayout getLayout() const {return layout;};
+
+    //
+    // Choose how firstHit() and anyHit() walk the tree (default
+    // BVH_TRAVERSE_STACK)
+    //
+    void setTraversal(BVHTraversal t);
+    BVHTraversal getTraversal() const {return walk;};
+
+    //
+    // Make build() (and so update()'s rebuilds) optimize every tree it
+    // builds with this many passes; 0 (the default) doesn't
+    //
+    void setOptimizePasses(int p) {optimizePasses = p;};
+    int getOptimizePasses() const {return optimizePasses;};
+
+    //
+    // Call after objects have moved (Sphere::setCenter,
+    // Triangle::setVertices).  Refits the node boxes to the objects'
+    // new bounds; if that has made the tree more than rebuildThreshold
+    // times as expensive (by SAH cost) as when it was built, rebuilds
+    // it instead.  Returns true if it rebuilt.
+    //
+    bool update();
+
+    //
+    // Recompute every node box bottom-up, keeping the tree topology
+    //
+    void refit();
+
+    //
+    // Expected cost of tracing a ray through the tree, by the surface
+    // area heuristic, relative to one primitive test
+    //
+    float sahCost() const;
+
+    //
+    // SAH cost now, divided by the SAH cost right after the last build
+    //
+    float degradation() const;
+
+    void setRebuildThreshold(float t) {rebuildThreshold = t;};
+
+    //
+    // BVH_SBVH: spatial splits may add at most this many references
+    // per primitive (0.3 = 30% more leaf entries than primitives)
+    //
+    void setSplitBudget(float b) {splitBudget = b;};
+    float getSplitBudget() const {return splitBudget;};
+
+    // true iff nothing has been built
+    bool isEmpty() const {return nodes.empty();};
+
+    int nodeCount() const {return (int)nodes.size();};
+
+    // The tree itself, for BVH8::collapse()
+    const BVHNodeArray& getNodes() const {return nodes;};
+    const vector<Object*>& getPrims() const {return prims;};
+
+    //
+    // Print build method, build time and size of the hierarchy
+    //
+    void printStats(ostream& os) const;
+
+    //
+    // Rays, node visits and primitive tests of firstHit() and anyHit()
+    // since the last reset
+    //
+    void resetTraversalStats() {traversal.reset();};
+    const TraversalStats& traversalStats() const {return traversal;};
+
+    // Bytes of nodes, primitive references, parent links and the
+    // compiled primitives
+    size_t memoryBytes() const {
+        return nodes.size() * sizeof(BVHNode) + prims.size() * sizeof(Object*) +
+               parents.size() * sizeof(int) + primList.memoryBytes();
+    };
+
+private:
+    void buildSweep(BVHBuildState& state, int begin, int end,
+                    int nodeIndex, int depth);
+    void buildBinned(BVHBuildState& state, int begin, int end,
+                     int nodeIndex, int depth);
+    void buildLinear(BVHBuildState& state);
+    void buildSpatial(BVHBuildState& state, vector<BVHBuildRef>& refs,
+                      int nodeIndex, int depth);
+    static void findObjectSplit(const BVHBuildRef *refs, int n,
+                                BVHBinning& binning);
+    static int partitionObjects(BVHBuildRef *refs, int n,
+                                const BVHBinning& binning);
+    void collectSubtrees(int nodeIndex, int depth, vector<int>& tasks) const;
+    void optimizeNode(int nodeIndex, int depth, int stopDepth,
+                      vector<float>& cost, vector<int>& height);
+    void restructureTreelet(int root, int depth, vector<float>& cost,
+                            vector<int>& height);
+    template <class Query>
+    bool traverseStack(Ray4& ray, Query& query, float tmax);
+    template <class Query>
+    bool traverseShortStack(Ray4& ray, Query& query, float tmax,
+                            int capacity);
+    void linkParents();
+    void groupLeaves();
+    void makeLeaf(int nodeIndex, int begin, int end);
+    void makeInner(BVHBuildState& state, int nodeIndex);
+    BBox refitNode(int nodeIndex);
+
+    BVHNodeArray nodes;      // nodes[0] is the root; nodes[1] is unused
+    vector<Object*> prims;   // objects, in leaf order (BVH_SBVH:
+                             // some more than once)
+    int objectCount;         // distinct objects in prims
+    vector<int> parents;     // parents[p]: the node whose children are
+                             // nodes[2p], nodes[2p+1] (only for the
+                             // traversals that climb)
+    PrimitiveList primList;  // prims compiled for the leaves' tests; each
+                             // leaf is grouped by type (groupLeaves())
+
+    BVHBuildMethod method;   // how the current tree was built
+    double buildMillis;      // and how long it took
+    bool loaded;             // taken from a cache rather than built
+    float builtCost;         // SAH cost right after the build
+    float rebuildThreshold;  // update() rebuilds past this degradation
+    float splitBudget;       // duplicate references allowed, per object
+
+    int optimizePasses;      // treelet passes after each build
+    BVHLayout layout;        // node order after each build
+    BVHTraversal walk;       // how the queries walk the tree
+    float unoptimizedCost;   // SAH cost before optimize() (0: not run)
+    double optimizeMillis;   // and how long it took
+
+    TraversalStats traversal;
+};
+
+#endif
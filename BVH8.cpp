@@ -0,0 +1,352 @@
+#include "BVH8.h"
+#include "BVH8Kernel.h"
+#include "Isa.h"
+
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+//
+// Box test one child at a time, for machines (or builds) without SSE4.2.
+// Same arithmetic as the vector kernels, so all find the same hits.
+//
+struct ScalarBoxTest {
+    struct Ray {
+        float org[3];
+        float inv[3];
+        int nearHi[3];      // 1 if the near plane on that axis is hi[]
+
+        Ray(const float o[3], const float i[3]) {
+            for (int a = 0; a < 3; a++) {
+                org[a] = o[a];
+                inv[a] = i[a];
+                nearHi[a] = (i[a] < 0);
+            }
+        }
+    };
+
+    static inline unsigned test(const BVH8Node& node, const Ray& r,
+                                float tmax, float tEnter[8]) {
+        unsigned mask = 0;
+        for (int c = 0; c < 8; c++) {
+            float t0 = 0;
+            float t1 = tmax;
+            for (int a = 0; a < 3; a++) {
+                float nearP = r.nearHi[a] ? node.hi[a][c] : node.lo[a][c];
+                float farP  = r.nearHi[a] ? node.lo[a][c] : node.hi[a][c];
+                float tNear = (nearP - r.org[a]) * r.inv[a];
+                float tFar  = (farP  - r.org[a]) * r.inv[a] * BVH8_FAR_SCALE;
+                t0 = tNear > t0 ? tNear : t0;
+                t1 = tFar  < t1 ? tFar  : t1;
+            }
+            tEnter[c] = t0;
+            if (t0 <= t1)
+                mask |= 1u << c;
+        }
+        return mask;
+    }
+};
+
+//
+// The same test against the child boxes of a quantized node
+//
+struct ScalarQBoxTest {
+    typedef ScalarBoxTest::Ray Ray;
+
+    static inline unsigned test(const BVH8QNode& node, const Ray& r,
+                                float tmax, float tEnter[8]) {
+        float base[3], scale[3];
+        for (int a = 0; a < 3; a++) {
+            base[a] = node.origin[a] - r.org[a];
+            scale[a] = bvh8Pow2(node.exponent[a]);
+        }
+
+        unsigned valid = node.interiorMask;
+        for (int c = 0; c < 8; c++)
+            if (node.count[c] > 0)
+                valid |= 1u << c;
+
+        unsigned mask = 0;
+        for (int c = 0; c < 8; c++) {
+            float t0 = 0;
+            float t1 = tmax;
+            for (int a = 0; a < 3; a++) {
+                float nearQ = r.nearHi[a] ? node.qhi[a][c] : node.qlo[a][c];
+                float farQ  = r.nearHi[a] ? node.qlo[a][c] : node.qhi[a][c];
+                float tNear = (base[a] + nearQ * scale[a]) * r.inv[a];
+                float tFar  = (base[a] + farQ  * scale[a]) * r.inv[a] * BVH8_FAR_SCALE;
+                t0 = tNear > t0 ? tNear : t0;
+                t1 = tFar  < t1 ? tFar  : t1;
+            }
+            tEnter[c] = t0;
+            if (t0 <= t1)
+                mask |= 1u << c;
+        }
+        return mask & valid;
+    }
+};
+
+bool bvh8FirstHitScalar(const BVH8Node *nodes, Object * const *prims,
+                        const PrimitiveList& primList,
+                        Ray4& ray, Hit& hit, float tmax,
+                        TraversalStats& stats)
+{
+    ClosestHitQuery query(hit);
+    return bvh8Traverse<BVH8Node, ScalarBoxTest>(nodes, prims, primList,
+                                                 ray, query, tmax, stats);
+}
+
+bool bvh8QFirstHitScalar(const BVH8QNode *nodes, Object * const *prims,
+                         const PrimitiveList& primList,
+                         Ray4& ray, Hit& hit, float tmax,
+                         TraversalStats& stats)
+{
+    ClosestHitQuery query(hit);
+    return bvh8Traverse<BVH8QNode, ScalarQBoxTest>(nodes, prims, primList,
+                                                   ray, query, tmax, stats);
+}
+
+bool bvh8AnyHitScalar(const BVH8Node *nodes, Object * const *prims,
+                      const PrimitiveList& primList,
+                      Ray4& ray, float tmin, float tmax,
+                      TraversalStats& stats)
+{
+    AnyHitQuery query(tmin);
+    return bvh8Traverse<BVH8Node, ScalarBoxTest>(nodes, prims, primList,
+                                                 ray, query, tmax, stats);
+}
+
+bool bvh8QAnyHitScalar(const BVH8QNode *nodes, Object * const *prims,
+                       const PrimitiveList& primList,
+                       Ray4& ray, float tmin, float tmax,
+                       TraversalStats& stats)
+{
+    AnyHitQuery query(tmin);
+    return bvh8Traverse<BVH8QNode, ScalarQBoxTest>(nodes, prims, primList,
+                                                   ray, query, tmax, stats);
+}
+
+/////////////////////////////////////////////////////////////////////////
+// The widest kernels built in that activeIsa() allows.  There is no
+// AVX-512 box test: one node is only eight boxes wide.
+/////////////////////////////////////////////////////////////////////////
+BVH8::BVH8()
+{
+    compressed = false;
+    kernelName = isaName(ISA_SCALAR);
+    kernel = bvh8FirstHitScalar;
+    qkernel = bvh8QFirstHitScalar;
+    anyKernel = bvh8AnyHitScalar;
+    qanyKernel = bvh8QAnyHitScalar;
+
+    IsaLevel isa = activeIsa();
+    if (isa >= ISA_AVX2 && bvh8Avx2Kernel() != NULL) {
+        kernelName = isaName(ISA_AVX2);
+        kernel = bvh8Avx2Kernel();
+        qkernel = bvh8QAvx2Kernel();
+        anyKernel = bvh8Avx2AnyKernel();
+        qanyKernel = bvh8QAvx2AnyKernel();
+    }
+    else if (isa >= ISA_SSE42 && bvh8Sse4Kernel() != NULL) {
+        kernelName = isaName(ISA_SSE42);
+        kernel = bvh8Sse4Kernel();
+        qkernel = bvh8QSse4Kernel();
+        anyKernel = bvh8Sse4AnyKernel();
+        qanyKernel = bvh8QSse4AnyKernel();
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////
+// Collapse a binary hierarchy into this one
+/////////////////////////////////////////////////////////////////////////
+void BVH8::collapse(BVH& bvh, bool compress)
+{
+    nodes.clear();
+    qnodes.clear();
+    prims.clear();
+    compressed = compress;
+
+    if (bvh.isEmpty()) {
+        primList.compile(NULL, 0);
+        return;
+    }
+
+    if (compress) {
+        // Leaf primitives are regrouped so that each node's are adjacent
+        prims.reserve(bvh.getPrims().size());
+        qnodes.reserve(bvh.nodeCount() / 4 + 1);
+        qnodes.resize(1);
+        compressNode(bvh.getNodes(), 0, 0, bvh.getPrims());
+    }
+    else {
+        prims = bvh.getPrims();
+        nodes.reserve(bvh.nodeCount() / 4 + 1);
+        collapseNode(bvh.getNodes(), 0);
+    }
+    primList.compile(&prims[0], (int)prims.size());
+}
+
+/////////////////////////////////////////////////////////////////////////
+// Pick the (up to) eight binary nodes that become the children of the
+// 8-wide node made from "binaryIndex": start from its two children and
+// keep opening the interior child with the largest surface area until
+// there are eight, or only leaves remain.  Returns how many.
+/////////////////////////////////////////////////////////////////////////
+int BVH8::gatherChildren(const BVHNodeArray& binary, int binaryIndex,
+                         int slots[8])
+{
+    int n = 0;
+
+    const BVHNode& top = binary[binaryIndex];
+    if (top.isLeaf()) {
+        slots[n++] = binaryIndex;
+    }
+    else {
+        slots[n++] = top.first;
+        slots[n++] = top.first + 1;
+
+        while (n < 8) {
+            int open = -1;
+            float openArea = -1;
+            for (int i = 0; i < n; i++) {
+                const BVHNode& b = binary[slots[i]];
+                if (!b.isLeaf() && b.box.surfaceArea() > openArea) {
+                    open = i;
+                    openArea = b.box.surfaceArea();
+                }
+            }
+            if (open < 0)
+                break;
+            int first = binary[slots[open]].first;
+            slots[open] = first;
+            slots[n++] = first + 1;
+        }
+    }
+
+    return n;
+}
+
+/////////////////////////////////////////////////////////////////////////
+// Make a full-precision node out of the binary node "binaryIndex"
+/////////////////////////////////////////////////////////////////////////
+int BVH8::collapseNode(const BVHNodeArray& binary, int binaryIndex)
+{
+    int slots[8];
+    int n = gatherChildren(binary, binaryIndex, slots);
+
+    int index = (int)nodes.size();
+    nodes.push_back(BVH8Node());
+
+    for (int c = 0; c < 8; c++) {
+        BVH8Node& node = nodes[index];
+        if (c >= n) {
+            for (int a = 0; a < 3; a++) {
+                node.lo[a][c] =  FLT_MAX;
+                node.hi[a][c] = -FLT_MAX;
+            }
+            node.child[c] = 0;
+            node.count[c] = 0;
+            continue;
+        }
+
+        const BVHNode& b = binary[slots[c]];
+        for (int a = 0; a < 3; a++) {
+            node.lo[a][c] = b.box.lo[a];
+            node.hi[a][c] = b.box.hi[a];
+        }
+        if (b.isLeaf()) {
+            node.child[c] = b.first;
+            node.count[c] = b.count;
+        }
+        else {
+            // collapseNode() may grow "nodes", so look "node" up again
+            int child = collapseNode(binary, slots[c]);
+            nodes[index].child[c] = child;
+            nodes[index].count[c] = 0;
+        }
+    }
+
+    return index;
+}
+
+/////////////////////////////////////////////////////////////////////////
+// Make the quantized node qnodes[index] out of the binary node
+// "binaryIndex".  Its interior children get consecutive slots at the
+// end of qnodes, and its leaves' primitives consecutive slots at the
+// end of prims.
+/////////////////////////////////////////////////////////////////////////
+void BVH8::compressNode(const BVHNodeArray& binary, int binaryIndex,
+                        int index, const vector<Object*>& binaryPrims)
+{
+    int slots[8];
+    int n = gatherChildren(binary, binaryIndex, slots);
+    const BBox& box = binary[binaryIndex].box;
+
+    BVH8QNode node;
+    memset(&node, 0, sizeof(node));
+
+    // The smallest power-of-two cell size for which 255 cells
+    // cover the node's box
+    float scale[3];
+    for (int a = 0; a < 3; a++) {
+        float extent = box.hi[a] - box.lo[a];
+        int e = (extent > 0) ? (int)ceilf(log2f(extent / 255)) : -100;
+        e = max(-100, min(e, 127));
+        while (e < 127 && box.lo[a] + 255 * bvh8Pow2(e) < box.hi[a])
+            e++;
+        node.origin[a] = box.lo[a];
+        node.exponent[a] = (int8_t)e;
+        scale[a] = bvh8Pow2(e);
+    }
+
+    node.primBase = (int)prims.size();
+    int interior = 0;
+
+    for (int c = 0; c < n; c++) {
+        const BVHNode& b = binary[slots[c]];
+
+        // Round outwards, checking against the decoded value
+        for (int a = 0; a < 3; a++) {
+            float p = node.origin[a];
+            int lo = (int)floorf((b.box.lo[a] - p) / scale[a]);
+            int hi = (int)ceilf((b.box.hi[a] - p) / scale[a]);
+            lo = max(0, min(lo, 255));
+            hi = max(0, min(hi, 255));
+            while (lo > 0 && p + lo * scale[a] > b.box.lo[a])
+                lo--;
+            while (hi < 255 && p + hi * scale[a] < b.box.hi[a])
+                hi++;
+            node.qlo[a][c] = (uint8_t)lo;
+            node.qhi[a][c] = (uint8_t)hi;
+        }
+
+        if (b.isLeaf()) {
+            node.count[c] = (uint8_t)b.count;
+            for (int i = b.first; i < b.first + b.count; i++)
+                prims.push_back(binaryPrims[i]);
+        }
+        else {
+            node.interiorMask |= 1u << c;
+            interior++;
+        }
+    }
+
+    node.childBase = (int)qnodes.size();
+    qnodes.resize(qnodes.size() + interior);
+    qnodes[index] = node;
+
+    int k = 0;
+    for (int c = 0; c < n; c++)
+        if (node.interiorMask & (1u << c))
+            compressNode(binary, slots[c], node.childBase + k++, binaryPrims);
+}
+
+void BVH8::printStats(ostream& os) const
+{
+    os << "BVH8: " << nodeCount()
+       << (compressed ? " quantized" : "") << " nodes, "
+       << nodeBytes() / 1024 << " KB ("
+       << (prims.empty() ? 0.0 : (double)nodeBytes() / prims.size())
+       << " bytes/primitive), "
+       << kernelName << " kernel" << endl;
+}
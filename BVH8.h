@@ -0,0 +1,195 @@
+#if !defined(_BVH8_H_)
+
+#define _BVH8_H_
+
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+#include "BVH.h"
+#include "GeomLib.h"
+#include "Hit.h"
+#include "Object.h"
+#include "TraversalStats.h"
+
+//
+// One node of the 8-wide hierarchy.  The boxes of the eight children
+// are stored axis by axis (structure of arrays), so that one ray can
+// be tested against all of them with a handful of vector instructions.
+// Unused child slots hold an empty box, which no ray can hit.
+//   count[i] == 0: child i is the interior node nodes[child[i]]
+//   count[i] >  0: child i is a leaf of prims[child[i]] .. +count[i]-1
+//
+struct BVH8Node {
+    float lo[3][8];
+    float hi[3][8];
+    int child[8];
+    int count[8];
+};
+
+//
+// The same node, compressed (Ylitie, Karras and Laine, "Efficient
+// Incoherent Ray Traversal on GPUs Through Compressed Wide BVHs",
+// HPG 2017): 80 bytes instead of 256.  Child boxes are stored as 8-bit
+// offsets on a grid laid over this node's own box; the grid starts at
+// "origin" and its cells are 2^exponent wide along each axis, which
+// makes decoding one multiply-add.  Boxes are rounded outwards, so they
+// still enclose their children.
+//
+// The interior children are stored next to each other from
+// nodes[childBase], in slot order, and the leaf children's primitives
+// next to each other from prims[primBase], also in slot order:
+//   bit i of interiorMask set:  child i is the next interior node
+//   count[i] > 0:               child i is a leaf of count[i] primitives
+//   neither:                    slot i is unused
+//
+struct BVH8QNode {
+    float origin[3];
+    int8_t exponent[3];
+    uint8_t interiorMask;
+    int childBase;
+    int primBase;
+    uint8_t count[8];
+    uint8_t qlo[3][8];
+    uint8_t qhi[3][8];
+};
+
+// Node storage, starting on a cache line
+typedef vector<BVH8Node, AlignedAllocator<BVH8Node, 64> > BVH8NodeArray;
+typedef vector<BVH8QNode, AlignedAllocator<BVH8QNode, 64> > BVH8QNodeArray;
+
+//
+// Traversal kernels: closest hit with t < tmax, as BVH8::firstHit()
+//
+typedef bool (*BVH8Kernel)(const BVH8Node *nodes, Object * const *prims,
+                           const PrimitiveList& primList,
+                           Ray4& ray, Hit& hit, float tmax,
+                           TraversalStats& stats);
+typedef bool (*BVH8QKernel)(const BVH8QNode *nodes, Object * const *prims,
+                            const PrimitiveList& primList,
+                            Ray4& ray, Hit& hit, float tmax,
+                            TraversalStats& stats);
+
+//
+// and any hit with tmin <= t < tmax, as BVH8::anyHit()
+//
+typedef bool (*BVH8AnyKernel)(const BVH8Node *nodes, Object * const *prims,
+                              const PrimitiveList& primList,
+                              Ray4& ray, float tmin, float tmax,
+                              TraversalStats& stats);
+typedef bool (*BVH8QAnyKernel)(const BVH8QNode *nodes, Object * const *prims,
+                               const PrimitiveList& primList,
+                               Ray4& ray, float tmin, float tmax,
+                               TraversalStats& stats);
+
+//
+// Kernels, one per instruction set.  The SSE4.2 and AVX2 ones are NULL
+// when the binary was built without support for theirs (see
+// Makefile.linux).  BVH8 picks one set by activeIsa() (see Isa.h).
+//
+bool bvh8FirstHitScalar(const BVH8Node *nodes, Object * const *prims,
+                        const PrimitiveList& primList,
+                        Ray4& ray, Hit& hit, float tmax,
+                        TraversalStats& stats);
+bool bvh8QFirstHitScalar(const BVH8QNode *nodes, Object * const *prims,
+                         const PrimitiveList& primList,
+                         Ray4& ray, Hit& hit, float tmax,
+                         TraversalStats& stats);
+bool bvh8AnyHitScalar(const BVH8Node *nodes, Object * const *prims,
+                      const PrimitiveList& primList,
+                      Ray4& ray, float tmin, float tmax,
+                      TraversalStats& stats);
+bool bvh8QAnyHitScalar(const BVH8QNode *nodes, Object * const *prims,
+                       const PrimitiveList& primList,
+                       Ray4& ray, float tmin, float tmax,
+                       TraversalStats& stats);
+BVH8Kernel bvh8Sse4Kernel();
+BVH8QKernel bvh8QSse4Kernel();
+BVH8AnyKernel bvh8Sse4AnyKernel();
+BVH8QAnyKernel bvh8QSse4AnyKernel();
+BVH8Kernel bvh8Avx2Kernel();
+BVH8QKernel bvh8QAvx2Kernel();
+BVH8AnyKernel bvh8Avx2AnyKernel();
+BVH8QAnyKernel bvh8QAvx2AnyKernel();
+
+//
+// An 8-wide bounding volume hierarchy, made by collapsing a binary one:
+// each node takes over up to eight descendants of a binary node.
+//
+class BVH8 {
+public:
+    BVH8();
+
+    //
+    // (Re)build from a binary hierarchy, with full-precision nodes or,
+    // if "compress" is set, quantized ones.  Call again whenever "bvh"
+    // has been rebuilt or refit; the collapse itself is linear.
+    //
+    void collapse(BVH& bvh, bool compress = false);
+
+    //
+    // Find the closest object hit by "ray" with t < tmax.
+    // If there is one, fill in "hit" and return true.
+    //
+    bool firstHit(Ray4& ray, Hit& hit, float tmax) {
+        if (compressed)
+            return !qnodes.empty() &&
+                   qkernel(&qnodes[0], &prims[0], primList, ray, hit, tmax,
+                           traversal);
+        return !nodes.empty() &&
+               kernel(&nodes[0], &prims[0], primList, ray, hit, tmax,
+                      traversal);
+    };
+
+    //
+    // true iff "ray" hits anything with tmin <= t < tmax
+    //
+    bool anyHit(Ray4& ray, float tmin, float tmax) {
+        if (compressed)
+            return !qnodes.empty() &&
+                   qanyKernel(&qnodes[0], &prims[0], primList, ray, tmin,
+                              tmax, traversal);
+        return !nodes.empty() &&
+               anyKernel(&nodes[0], &prims[0], primList, ray, tmin, tmax,
+                         traversal);
+    };
+
+    bool isEmpty() const {return nodes.empty() && qnodes.empty();};
+
+    int nodeCount() const {return (int)(compressed ? qnodes.size() : nodes.size());};
+
+    // Rays, node visits and primitive tests since the last reset
+    void resetTraversalStats() {traversal.reset();};
+    const TraversalStats& traversalStats() const {return traversal;};
+
+    // Bytes of node data
+    size_t nodeBytes() const {
+        return nodes.size() * sizeof(BVH8Node) + qnodes.size() * sizeof(BVH8QNode);
+    };
+
+    //
+    // Print node count, memory per primitive and which kernel is in use
+    //
+    void printStats(ostream& os) const;
+
+private:
+    int gatherChildren(const BVHNodeArray& binary, int binaryIndex,
+                       int slots[8]);
+    int collapseNode(const BVHNodeArray& binary, int binaryIndex);
+    void compressNode(const BVHNodeArray& binary, int binaryIndex,
+                      int index, const vector<Object*>& binaryPrims);
+
+    BVH8NodeArray nodes;      // full-precision nodes; nodes[0] is the root
+    BVH8QNodeArray qnodes;    // or quantized ones; qnodes[0] is the root
+    vector<Object*> prims;    // objects, in leaf order
+    PrimitiveList primList;   // prims compiled for the leaves' tests
+    bool compressed;          // which of the two is in use
+    BVH8Kernel kernel;
+    BVH8QKernel qkernel;
+    BVH8AnyKernel anyKernel;
+    BVH8QAnyKernel qanyKernel;
+    const char *kernelName;   // that of the instruction set used
+    TraversalStats traversal;
+};
+
+#endif
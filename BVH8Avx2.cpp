@@ -0,0 +1,186 @@
+//////////////////////////////////////////////////////
+//
+// AVX2 traversal kernel for the 8-wide BVH.
+// Makefile.linux compiles this file with -mavx2; other
+// builds get an empty kernel, and BVH8 falls back to
+// the scalar one.
+//
+//////////////////////////////////////////////////////
+
+#include "BVH8.h"
+
+#if defined(__AVX2__)
+
+#include <immintrin.h>
+
+#include "BVH8Kernel.h"
+
+//
+// One slab test of a ray against all eight children of a node
+//
+struct Avx2BoxTest {
+    struct Ray {
+        __m256 org[3];
+        __m256 inv[3];
+        int nearHi[3];      // 1 if the near plane on that axis is hi[]
+
+        Ray(const float o[3], const float i[3]) {
+            for (int a = 0; a < 3; a++) {
+                org[a] = _mm256_set1_ps(o[a]);
+                inv[a] = _mm256_set1_ps(i[a]);
+                nearHi[a] = (i[a] < 0);
+            }
+        }
+    };
+
+    static inline unsigned test(const BVH8Node& node, const Ray& r,
+                                float tmax, float tEnter[8]) {
+        const __m256 farScale = _mm256_set1_ps(BVH8_FAR_SCALE);
+        __m256 t0 = _mm256_setzero_ps();
+        __m256 t1 = _mm256_set1_ps(tmax);
+
+        for (int a = 0; a < 3; a++) {
+            const float *nearP = r.nearHi[a] ? node.hi[a] : node.lo[a];
+            const float *farP  = r.nearHi[a] ? node.lo[a] : node.hi[a];
+            __m256 tNear = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(nearP), r.org[a]),
+                                         r.inv[a]);
+            __m256 tFar  = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(farP), r.org[a]),
+                                         r.inv[a]);
+            tFar = _mm256_mul_ps(tFar, farScale);
+
+            // max/min return their second operand if either is NaN
+            // (0 * inf), which leaves the interval unchanged.
+            t0 = _mm256_max_ps(tNear, t0);
+            t1 = _mm256_min_ps(tFar, t1);
+        }
+
+        _mm256_storeu_ps(tEnter, t0);
+        return (unsigned)_mm256_movemask_ps(_mm256_cmp_ps(t0, t1, _CMP_LE_OQ));
+    }
+};
+
+//
+// The same against a quantized node: widen the 8-bit offsets to
+// floats, then decode and slab test all eight boxes at once
+//
+struct Avx2QBoxTest {
+    typedef Avx2BoxTest::Ray Ray;
+
+    static inline __m256 load8(const uint8_t *q) {
+        __m128i bytes = _mm_loadl_epi64((const __m128i *)q);
+        return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(bytes));
+    }
+
+    static inline unsigned test(const BVH8QNode& node, const Ray& r,
+                                float tmax, float tEnter[8]) {
+        const __m256 farScale = _mm256_set1_ps(BVH8_FAR_SCALE);
+        __m256 t0 = _mm256_setzero_ps();
+        __m256 t1 = _mm256_set1_ps(tmax);
+
+        for (int a = 0; a < 3; a++) {
+            __m256 base  = _mm256_sub_ps(_mm256_set1_ps(node.origin[a]), r.org[a]);
+            __m256 scale = _mm256_set1_ps(bvh8Pow2(node.exponent[a]));
+            const uint8_t *nearQ = r.nearHi[a] ? node.qhi[a] : node.qlo[a];
+            const uint8_t *farQ  = r.nearHi[a] ? node.qlo[a] : node.qhi[a];
+            __m256 tNear = _mm256_mul_ps(_mm256_add_ps(base, _mm256_mul_ps(load8(nearQ), scale)),
+                                         r.inv[a]);
+            __m256 tFar  = _mm256_mul_ps(_mm256_add_ps(base, _mm256_mul_ps(load8(farQ), scale)),
+                                         r.inv[a]);
+            tFar = _mm256_mul_ps(tFar, farScale);
+            t0 = _mm256_max_ps(tNear, t0);
+            t1 = _mm256_min_ps(tFar, t1);
+        }
+
+        // Slots that hold neither a leaf nor an interior node are unused
+        __m128i counts = _mm_loadl_epi64((const __m128i *)node.count);
+        unsigned empty = _mm_movemask_epi8(_mm_cmpeq_epi8(counts, _mm_setzero_si128()));
+        unsigned valid = node.interiorMask | (~empty & 0xff);
+
+        _mm256_storeu_ps(tEnter, t0);
+        return valid & (unsigned)_mm256_movemask_ps(_mm256_cmp_ps(t0, t1, _CMP_LE_OQ));
+    }
+};
+
+static bool bvh8FirstHitAvx2(const BVH8Node *nodes, Object * const *prims,
+                             const PrimitiveList& primList,
+                             Ray4& ray, Hit& hit, float tmax,
+                             TraversalStats& stats)
+{
+    ClosestHitQuery query(hit);
+    return bvh8Traverse<BVH8Node, Avx2BoxTest>(nodes, prims, primList,
+                                               ray, query, tmax, stats);
+}
+
+static bool bvh8QFirstHitAvx2(const BVH8QNode *nodes, Object * const *prims,
+                              const PrimitiveList& primList,
+                              Ray4& ray, Hit& hit, float tmax,
+                              TraversalStats& stats)
+{
+    ClosestHitQuery query(hit);
+    return bvh8Traverse<BVH8QNode, Avx2QBoxTest>(nodes, prims, primList,
+                                                 ray, query, tmax, stats);
+}
+
+static bool bvh8AnyHitAvx2(const BVH8Node *nodes, Object * const *prims,
+                           const PrimitiveList& primList,
+                           Ray4& ray, float tmin, float tmax,
+                           TraversalStats& stats)
+{
+    AnyHitQuery query(tmin);
+    return bvh8Traverse<BVH8Node, Avx2BoxTest>(nodes, prims, primList,
+                                               ray, query, tmax, stats);
+}
+
+static bool bvh8QAnyHitAvx2(const BVH8QNode *nodes, Object * const *prims,
+                            const PrimitiveList& primList,
+                            Ray4& ray, float tmin, float tmax,
+                            TraversalStats& stats)
+{
+    AnyHitQuery query(tmin);
+    return bvh8Traverse<BVH8QNode, Avx2QBoxTest>(nodes, prims, primList,
+                                                 ray, query, tmax, stats);
+}
+
+BVH8Kernel bvh8Avx2Kernel()
+{
+    return bvh8FirstHitAvx2;
+}
+
+BVH8QKernel bvh8QAvx2Kernel()
+{
+    return bvh8QFirstHitAvx2;
+}
+
+BVH8AnyKernel bvh8Avx2AnyKernel()
+{
+    return bvh8AnyHitAvx2;
+}
+
+BVH8QAnyKernel bvh8QAvx2AnyKernel()
+{
+    return bvh8QAnyHitAvx2;
+}
+
+#else
+
+BVH8Kernel bvh8Avx2Kernel()
+{
+    return NULL;
+}
+
+BVH8QKernel bvh8QAvx2Kernel()
+{
+    return NULL;
+}
+
+BVH8AnyKernel bvh8Avx2AnyKernel()
+{
+    return NULL;
+}
+
+BVH8QAnyKernel bvh8QAvx2AnyKernel()
+{
+    return NULL;
+}
+
+#endif
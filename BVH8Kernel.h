@@ -0,0 +1,168 @@
+#if !defined(_BVH8KERNEL_H_)
+
+#define _BVH8KERNEL_H_
+
+//////////////////////////////////////////////////////
+//
+// Traversal of an 8-wide BVH, shared by the
+// per-instruction-set kernels, both node formats and
+// both kinds of query (RayQuery.h).  Each kernel file supplies a BoxTest class:
+//
+//   BoxTest::Ray(org, inv)     per-ray constants
+//   BoxTest::test(node, ray, tmax, tEnter)
+//       tests the ray against all 8 child boxes of
+//       "node", stores each entry distance in tEnter[]
+//       and returns a bit mask of the children hit.
+//
+// Everything here is a template or static, so each
+// kernel file gets its own copy compiled with its
+// own flags.
+//
+//////////////////////////////////////////////////////
+
+#include "BVH8.h"
+#include "RayQuery.h"
+
+// A binary tree of depth 128 (BVH.cpp's bound) collapses to at most
+// 128 levels, and every level leaves at most seven siblings behind.
+static const int BVH8_STACK_SIZE = 7 * 128 + 1;
+
+// Far planes are pushed out by a few ulps, so that flat boxes around
+// axis-aligned triangles are not missed through rounding.
+static const float BVH8_FAR_SCALE = 1.0000004f;
+
+//
+// Where the children of a node are, for either node format
+//
+static inline bool bvh8IsLeaf(const BVH8Node& node, int slot)
+{
+    return node.count[slot] > 0;
+}
+
+static inline int bvh8Child(const BVH8Node& node, int slot)
+{
+    return node.child[slot];
+}
+
+static inline void bvh8Leaf(const BVH8Node& node, int slot,
+                            int& first, int& count)
+{
+    first = node.child[slot];
+    count = node.count[slot];
+}
+
+static inline bool bvh8IsLeaf(const BVH8QNode& node, int slot)
+{
+    return node.count[slot] > 0;
+}
+
+static inline int bvh8Child(const BVH8QNode& node, int slot)
+{
+    return node.childBase +
+           __builtin_popcount(node.interiorMask & ((1u << slot) - 1));
+}
+
+static inline void bvh8Leaf(const BVH8QNode& node, int slot,
+                            int& first, int& count)
+{
+    first = node.primBase;
+    for (int c = 0; c < slot; c++)
+        first += node.count[c];
+    count = node.count[slot];
+}
+
+//
+// Traversal for "query" (see RayQuery.h) up to tmax.  Children are
+// visited near to far for both kinds of query: a shadow ray's blocker
+// is most often the surface it leaves or one close by.  Stack entries
+// >= 0 are interior nodes; leaves are entered as -(8 * node + slot) - 1.
+//
+template <class Node, class BoxTest, class Query>
+bool bvh8Traverse(const Node *nodes, Object * const *prims,
+                  const PrimitiveList& primList, Ray4& ray, Query& query,
+                  float tmax, TraversalStats& stats)
+{
+    float org[3], inv[3];
+    for (int a = 0; a < 3; a++) {
+        org[a] = ray.start[a];
+        inv[a] = 1.0f / ray.direction[a];
+    }
+    typename BoxTest::Ray r(org, inv);
+    SphereRay sphereRay(ray);
+
+    int   stack[BVH8_STACK_SIZE];
+    float stackT[BVH8_STACK_SIZE];
+    int sp = 0;
+
+    bool found = false;
+    int item = 0;
+    int visited = 0;
+    int tested = 0;
+
+    for (;;) {
+        if (item >= 0) {
+            const Node& node = nodes[item];
+            visited++;
+            float tEnter[8];
+            unsigned mask = BoxTest::test(node, r, tmax, tEnter);
+
+            // Sort the children hit from far to near, then push them
+            // all; the nearest ends up on top and is popped first.
+            int order[8];
+            int n = 0;
+            while (mask) {
+                int slot = __builtin_ctz(mask);
+                mask &= mask - 1;
+                int k = n++;
+                while (k > 0 && tEnter[order[k-1]] < tEnter[slot]) {
+                    order[k] = order[k-1];
+                    k--;
+                }
+                order[k] = slot;
+            }
+            for (int k = 0; k < n; k++) {
+                int slot = order[k];
+                stack[sp] = bvh8IsLeaf(node, slot) ? -(8 * item + slot) - 1
+                                                   : bvh8Child(node, slot);
+                if (!Query::anyHit)
+                    stackT[sp] = tEnter[slot];
+                sp++;
+            }
+        }
+        else {
+            int leaf = -item - 1;
+            int first, count;
+            bvh8Leaf(nodes[leaf / 8], leaf % 8, first, count);
+            if (queryLeaf(query, primList, prims, first, count, ray,
+                          sphereRay, tmax, tested)) {
+                found = true;
+                if (Query::anyHit)
+                    break;
+            }
+        }
+
+        // Pop the next entry that is still closer than the best hit
+        while (!Query::anyHit && sp > 0 && stackT[sp - 1] >= tmax)
+            sp--;
+        if (sp == 0)
+            break;
+        item = stack[--sp];
+    }
+
+    stats.rays++;
+    stats.nodes += visited;
+    stats.prims += tested;
+    return found;
+}
+
+//
+// 2^e as a float, for the exponents of quantized nodes
+//
+static inline float bvh8Pow2(int e)
+{
+    union {int i; float f;} bits;
+    bits.i = (e + 127) << 23;
+    return bits.f;
+}
+
+#endif
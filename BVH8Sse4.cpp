@@ -0,0 +1,203 @@
+//////////////////////////////////////////////////////
+//
+// SSE4.2 traversal kernel for the 8-wide BVH: each
+// node's eight boxes are tested as two halves of four.
+// Makefile.linux compiles this file with -msse4.2;
+// other builds get an empty kernel, and BVH8 falls
+// back to the scalar one.
+//
+//////////////////////////////////////////////////////
+
+#include "BVH8.h"
+
+#if defined(__SSE4_2__)
+
+#include <cstring>
+#include <smmintrin.h>
+
+#include "BVH8Kernel.h"
+
+//
+// One slab test of a ray against all eight children of a node
+//
+struct Sse4BoxTest {
+    struct Ray {
+        __m128 org[3];
+        __m128 inv[3];
+        int nearHi[3];      // 1 if the near plane on that axis is hi[]
+
+        Ray(const float o[3], const float i[3]) {
+            for (int a = 0; a < 3; a++) {
+                org[a] = _mm_set1_ps(o[a]);
+                inv[a] = _mm_set1_ps(i[a]);
+                nearHi[a] = (i[a] < 0);
+            }
+        }
+    };
+
+    // Children h .. h+3
+    static inline unsigned half(const BVH8Node& node, const Ray& r, int h,
+                                float tmax, float tEnter[8]) {
+        const __m128 farScale = _mm_set1_ps(BVH8_FAR_SCALE);
+        __m128 t0 = _mm_setzero_ps();
+        __m128 t1 = _mm_set1_ps(tmax);
+
+        for (int a = 0; a < 3; a++) {
+            const float *nearP = r.nearHi[a] ? node.hi[a] : node.lo[a];
+            const float *farP  = r.nearHi[a] ? node.lo[a] : node.hi[a];
+            __m128 tNear = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(nearP + h), r.org[a]),
+                                      r.inv[a]);
+            __m128 tFar  = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(farP + h), r.org[a]),
+                                      r.inv[a]);
+            tFar = _mm_mul_ps(tFar, farScale);
+
+            // max/min return their second operand if either is NaN
+            // (0 * inf), which leaves the interval unchanged.
+            t0 = _mm_max_ps(tNear, t0);
+            t1 = _mm_min_ps(tFar, t1);
+        }
+
+        _mm_storeu_ps(tEnter + h, t0);
+        return (unsigned)_mm_movemask_ps(_mm_cmple_ps(t0, t1)) << h;
+    }
+
+    static inline unsigned test(const BVH8Node& node, const Ray& r,
+                                float tmax, float tEnter[8]) {
+        return half(node, r, 0, tmax, tEnter) | half(node, r, 4, tmax, tEnter);
+    }
+};
+
+//
+// The same against a quantized node: widen the 8-bit offsets to
+// floats, then decode and slab test four boxes at a time
+//
+struct Sse4QBoxTest {
+    typedef Sse4BoxTest::Ray Ray;
+
+    static inline __m128 load4(const uint8_t *q) {
+        int bytes;
+        memcpy(&bytes, q, sizeof(bytes));
+        return _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(bytes)));
+    }
+
+    static inline unsigned half(const BVH8QNode& node, const Ray& r, int h,
+                                float tmax, float tEnter[8]) {
+        const __m128 farScale = _mm_set1_ps(BVH8_FAR_SCALE);
+        __m128 t0 = _mm_setzero_ps();
+        __m128 t1 = _mm_set1_ps(tmax);
+
+        for (int a = 0; a < 3; a++) {
+            __m128 base  = _mm_sub_ps(_mm_set1_ps(node.origin[a]), r.org[a]);
+            __m128 scale = _mm_set1_ps(bvh8Pow2(node.exponent[a]));
+            const uint8_t *nearQ = r.nearHi[a] ? node.qhi[a] : node.qlo[a];
+            const uint8_t *farQ  = r.nearHi[a] ? node.qlo[a] : node.qhi[a];
+            __m128 tNear = _mm_mul_ps(_mm_add_ps(base, _mm_mul_ps(load4(nearQ + h), scale)),
+                                      r.inv[a]);
+            __m128 tFar  = _mm_mul_ps(_mm_add_ps(base, _mm_mul_ps(load4(farQ + h), scale)),
+                                      r.inv[a]);
+            tFar = _mm_mul_ps(tFar, farScale);
+            t0 = _mm_max_ps(tNear, t0);
+            t1 = _mm_min_ps(tFar, t1);
+        }
+
+        _mm_storeu_ps(tEnter + h, t0);
+        return (unsigned)_mm_movemask_ps(_mm_cmple_ps(t0, t1)) << h;
+    }
+
+    static inline unsigned test(const BVH8QNode& node, const Ray& r,
+                                float tmax, float tEnter[8]) {
+        unsigned hit = half(node, r, 0, tmax, tEnter) |
+                       half(node, r, 4, tmax, tEnter);
+
+        // Slots that hold neither a leaf nor an interior node are unused
+        __m128i counts = _mm_loadl_epi64((const __m128i *)node.count);
+        unsigned empty = _mm_movemask_epi8(_mm_cmpeq_epi8(counts, _mm_setzero_si128()));
+        unsigned valid = node.interiorMask | (~empty & 0xff);
+
+        return valid & hit;
+    }
+};
+
+static bool bvh8FirstHitSse4(const BVH8Node *nodes, Object * const *prims,
+                             const PrimitiveList& primList,
+                             Ray4& ray, Hit& hit, float tmax,
+                             TraversalStats& stats)
+{
+    ClosestHitQuery query(hit);
+    return bvh8Traverse<BVH8Node, Sse4BoxTest>(nodes, prims, primList,
+                                               ray, query, tmax, stats);
+}
+
+static bool bvh8QFirstHitSse4(const BVH8QNode *nodes, Object * const *prims,
+                              const PrimitiveList& primList,
+                              Ray4& ray, Hit& hit, float tmax,
+                              TraversalStats& stats)
+{
+    ClosestHitQuery query(hit);
+    return bvh8Traverse<BVH8QNode, Sse4QBoxTest>(nodes, prims, primList,
+                                                 ray, query, tmax, stats);
+}
+
+static bool bvh8AnyHitSse4(const BVH8Node *nodes, Object * const *prims,
+                           const PrimitiveList& primList,
+                           Ray4& ray, float tmin, float tmax,
+                           TraversalStats& stats)
+{
+    AnyHitQuery query(tmin);
+    return bvh8Traverse<BVH8Node, Sse4BoxTest>(nodes, prims, primList,
+                                               ray, query, tmax, stats);
+}
+
+static bool bvh8QAnyHitSse4(const BVH8QNode *nodes, Object * const *prims,
+                            const PrimitiveList& primList,
+                            Ray4& ray, float tmin, float tmax,
+                            TraversalStats& stats)
+{
+    AnyHitQuery query(tmin);
+    return bvh8Traverse<BVH8QNode, Sse4QBoxTest>(nodes, prims, primList,
+                                                 ray, query, tmax, stats);
+}
+
+BVH8Kernel bvh8Sse4Kernel()
+{
+    return bvh8FirstHitSse4;
+}
+
+BVH8QKernel bvh8QSse4Kernel()
+{
+    return bvh8QFirstHitSse4;
+}
+
+BVH8AnyKernel bvh8Sse4AnyKernel()
+{
+    return bvh8AnyHitSse4;
+}
+
+BVH8QAnyKernel bvh8QSse4AnyKernel()
+{
+    return bvh8QAnyHitSse4;
+}
+
+#else
+
+BVH8Kernel bvh8Sse4Kernel()
+{
+    return NULL;
+}
+
+BVH8QKernel bvh8QSse4Kernel()
+{
+    return NULL;
+}
+
+BVH8AnyKernel bvh8Sse4AnyKernel()
+{
+    return NULL;
+}
+
+BVH8QAnyKernel bvh8QSse4AnyKernel()
+{
+    return NULL;
+}
+
+#endif
@@ -0,0 +1,274 @@
+#include "BVHCache.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <unordered_map>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Bump whenever the file format or the meaning of BVHNode changes
+static const uint32_t CACHE_VERSION = 1;
+
+static const char CACHE_MAGIC[8] = {'R', 'T', 'B', 'V', 'H', 'C', 0, 0};
+
+// Written as a native integer: reads back differently on a machine
+// of the other byte order
+static const uint32_t BYTE_ORDER_TAG = 0x01020304;
+
+//
+// The start of a cache file, padded to 64 bytes so that the nodes
+// after it start on a cache line in the mapping
+//
+struct CacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t nodeSize;      // sizeof(BVHNode)
+    uint32_t byteOrder;
+    uint32_t method;
+    uint64_t key;
+    int32_t nodeCount;      // then nodeCount BVHNodes
+    int32_t primCount;      // then primCount ints: the leaf order
+    int32_t objectCount;
+    char unused[20];
+};
+
+static_assert(sizeof(CacheHeader) == 64, "cache header must stay 64 bytes");
+
+//
+// A file's contents, read-only: mapped where the system can, read
+// into memory elsewhere
+//
+class MappedFile {
+public:
+    MappedFile() : data(NULL), size(0) {}
+    ~MappedFile() {close();}
+
+    bool open(const string& fileName);
+    void close();
+
+    const char *data;
+    size_t size;
+
+private:
+#if defined(_WIN32)
+    vector<char> buffer;
+#endif
+};
+
+#if defined(_WIN32)
+
+bool MappedFile::open(const string& fileName)
+{
+    ifstream file(fileName.c_str(), ios::binary);
+    if (!file)
+        return false;
+    file.seekg(0, ios::end);
+    buffer.resize((size_t)file.tellg());
+    file.seekg(0, ios::beg);
+    if (!buffer.empty() && !file.read(&buffer[0], buffer.size()))
+        return false;
+    data = buffer.empty() ? NULL : &buffer[0];
+    size = buffer.size();
+    return true;
+}
+
+void MappedFile::close()
+{
+    vector<char>().swap(buffer);
+    data = NULL;
+    size = 0;
+}
+
+#else
+
+bool MappedFile::open(const string& fileName)
+{
+    int fd = ::open(fileName.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        ::close(fd);
+        return false;
+    }
+
+    void *p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED)
+        return false;
+
+    data = (const char *)p;
+    size = (size_t)st.st_size;
+    return true;
+}
+
+void MappedFile::close()
+{
+    if (data != NULL)
+        munmap((void *)data, size);
+    data = NULL;
+    size = 0;
+}
+
+#endif
+
+//
+// 64-bit FNV-1a hash, continued from "hash" over n more bytes
+//
+static uint64_t fnv1a(uint64_t hash, const void *bytes, size_t n)
+{
+    const unsigned char *p = (const unsigned char *)bytes;
+    for (size_t i = 0; i < n; i++) {
+        hash ^= p[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static const uint64_t FNV_OFFSET_BASIS = 14695981039346656037ULL;
+
+/////////////////////////////////////////////////////////////////////////
+// Hash the scene file and the options the tree depends on
+/////////////////////////////////////////////////////////////////////////
+BVHCache::BVHCache(const char *sceneFile, const string& dir,
+                   BVHBuildMethod how, float splitBudget,
+                   int optimizePasses, BVHLayout layout)
+{
+    method = how;
+    key = 0;
+
+    ifstream file(sceneFile, ios::binary);
+    if (file) {
+        uint64_t hash = FNV_OFFSET_BASIS;
+        vector<char> chunk(1 << 16);
+        while (file) {
+            file.read(&chunk[0], chunk.size());
+            hash = fnv1a(hash, &chunk[0], (size_t)file.gcount());
+        }
+
+        int32_t m = (int32_t)how;
+        hash = fnv1a(hash, &m, sizeof(m));
+        if (how == BVH_SBVH)
+            hash = fnv1a(hash, &splitBudget, sizeof(splitBudget));
+        int32_t passes = optimizePasses;
+        hash = fnv1a(hash, &passes, sizeof(passes));
+        int32_t order = (int32_t)layout;
+        hash = fnv1a(hash, &order, sizeof(order));
+        key = (hash != 0) ? hash : 1;
+    }
+
+    if (dir.empty())
+        path = string(sceneFile) + ".bvhcache";
+    else {
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.bvhcache",
+                 (unsigned long long)key);
+        path = dir;
+        if (path[path.size() - 1] != '/')
+            path += '/';
+        path += name;
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////
+// Map the cache file, check its header against this scene and build,
+// and hand the arrays to the hierarchy
+/////////////////////////////////////////////////////////////////////////
+bool BVHCache::load(BVH& bvh, vector<Object*>& objects) const
+{
+    if (key == 0)
+        return false;
+
+    MappedFile file;
+    if (!file.open(path) || file.size < sizeof(CacheHeader))
+        return false;
+
+    CacheHeader header;
+    memcpy(&header, file.data, sizeof(header));
+    if (memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 ||
+        header.version != CACHE_VERSION ||
+        header.nodeSize != sizeof(BVHNode) ||
+        header.byteOrder != BYTE_ORDER_TAG ||
+        header.method != (uint32_t)method ||
+        header.key != key ||
+        header.objectCount != (int32_t)objects.size() ||
+        header.nodeCount < 1 || header.primCount < 1)
+        return false;
+
+    size_t nodeBytes = (size_t)header.nodeCount * sizeof(BVHNode);
+    size_t primBytes = (size_t)header.primCount * sizeof(int32_t);
+    if (file.size != sizeof(CacheHeader) + nodeBytes + primBytes)
+        return false;
+
+    const BVHNode *nodes = (const BVHNode *)(file.data + sizeof(CacheHeader));
+    const int *order = (const int *)(file.data + sizeof(CacheHeader) + nodeBytes);
+    return bvh.load(objects, nodes, header.nodeCount,
+                    order, header.primCount, method);
+}
+
+/////////////////////////////////////////////////////////////////////////
+// Write the cache file under a temporary name and move it into place,
+// so that a run reading it at the same time never sees half a file
+/////////////////////////////////////////////////////////////////////////
+bool BVHCache::save(const BVH& bvh, const vector<Object*>& objects) const
+{
+    if (key == 0 || bvh.isEmpty())
+        return false;
+
+    const BVHNodeArray& nodes = bvh.getNodes();
+    const vector<Object*>& prims = bvh.getPrims();
+
+    unordered_map<Object*, int> indexOf;
+    for (int i = 0; i < (int)objects.size(); i++)
+        indexOf[objects[i]] = i;
+    vector<int32_t> order(prims.size());
+    for (int i = 0; i < (int)prims.size(); i++) {
+        unordered_map<Object*, int>::const_iterator it = indexOf.find(prims[i]);
+        if (it == indexOf.end())
+            return false;
+        order[i] = it->second;
+    }
+
+    CacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.version = CACHE_VERSION;
+    header.nodeSize = sizeof(BVHNode);
+    header.byteOrder = BYTE_ORDER_TAG;
+    header.method = (uint32_t)method;
+    header.key = key;
+    header.nodeCount = (int32_t)nodes.size();
+    header.primCount = (int32_t)order.size();
+    header.objectCount = (int32_t)objects.size();
+
+    string temp = path + ".tmp";
+    {
+        ofstream file(temp.c_str(), ios::binary | ios::trunc);
+        if (!file)
+            return false;
+        file.write((const char *)&header, sizeof(header));
+        file.write((const char *)&nodes[0], nodes.size() * sizeof(BVHNode));
+        file.write((const char *)&order[0], order.size() * sizeof(int32_t));
+        if (!file) {
+            file.close();
+            remove(temp.c_str());
+            return false;
+        }
+    }
+
+#if defined(_WIN32)
+    remove(path.c_str());
+#endif
+    if (rename(temp.c_str(), path.c_str()) != 0) {
+        remove(temp.c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,55 @@
+#if !defined(_BVH_CACHE_H_)
+
+#define _BVH_CACHE_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "BVH.h"
+#include "Object.h"
+
+//
+// Built hierarchies kept on disk, so that reopening a scene maps the
+// saved tree in instead of building it again.
+//
+// A cache file holds a header, the nodes and the leaf order (as
+// indices into the scene's object list).  It is keyed by a hash of
+// the scene file's contents and of the build options, and tagged with
+// a format version and the node layout (node size, byte order).  A
+// file whose key or tag doesn't match is ignored, and overwritten by
+// the next save().
+//
+class BVHCache {
+public:
+    //
+    // Cache for the scene in "sceneFile", built with "method" (and
+    // "splitBudget", for BVH_SBVH) and "optimizePasses" rounds of
+    // BVH::optimize(), its nodes in "layout".  With an empty "dir" the cache file goes next
+    // to the scene file; otherwise into "dir", named after the key.
+    //
+    BVHCache(const char *sceneFile, const string& dir,
+             BVHBuildMethod method, float splitBudget, int optimizePasses,
+             BVHLayout layout);
+
+    //
+    // Load the saved hierarchy over "objects" into "bvh".  Returns
+    // false if there is no valid cache file for this scene.
+    //
+    bool load(BVH& bvh, vector<Object*>& objects) const;
+
+    //
+    // Save "bvh", built over "objects".  Returns false if the file
+    // can't be written.
+    //
+    bool save(const BVH& bvh, const vector<Object*>& objects) const;
+
+    const string& getPath() const {return path;};
+
+private:
+    string path;
+    uint64_t key;       // 0: the scene file couldn't be read
+    BVHBuildMethod method;
+};
+
+#endif
@@ -0,0 +1,131 @@
+//
+// Node layouts for the binary hierarchy.
+//
+// Siblings always share a 64-byte pair, so the unit that gets placed
+// is the pair: pair p holds nodes[2p] and nodes[2p+1], and pair 0 the
+// root (and the padding node).  The children of a node form the pair
+// nodes[first] / nodes[first+1], so the pairs make a tree of their own
+// with up to two children each.  A layout is an order of that tree's
+// pairs; reorder() moves every pair to its new place and points the
+// nodes at their children's new places.
+//
+
+#include "BVH.h"
+
+#include <algorithm>
+
+// The child pairs of pair "pair", those of the sibling with the larger
+// surface area (the one rays enter more often) first.  Returns how many.
+static int childPairs(const BVHNodeArray& nodes, int pair, int child[2])
+{
+    int n = 0;
+    float area[2];
+    int members = (pair == 0) ? 1 : 2;
+
+    for (int k = 0; k < members; k++) {
+        const BVHNode& node = nodes[2 * pair + k];
+        if (node.isLeaf())
+            continue;
+        child[n] = node.first / 2;
+        area[n] = node.box.surfaceArea();
+        n++;
+    }
+    if (n == 2 && area[1] > area[0])
+        swap(child[0], child[1]);
+    return n;
+}
+
+static void orderDepthFirst(const BVHNodeArray& nodes, int pair,
+                            vector<int>& order)
+{
+    order.push_back(pair);
+
+    int child[2];
+    int n = childPairs(nodes, pair, child);
+    for (int i = 0; i < n; i++)
+        orderDepthFirst(nodes, child[i], order);
+}
+
+// Levels of pairs in the subtree of pair "pair"
+static int pairHeight(const BVHNodeArray& nodes, int pair)
+{
+    int child[2];
+    int n = childPairs(nodes, pair, child);
+    int height = 0;
+    for (int i = 0; i < n; i++)
+        height = max(height, pairHeight(nodes, child[i]));
+    return height + 1;
+}
+
+// The pairs exactly "levels" levels below pair "pair"
+static void pairsBelow(const BVHNodeArray& nodes, int pair, int levels,
+                       vector<int>& below)
+{
+    if (levels == 0) {
+        below.push_back(pair);
+        return;
+    }
+
+    int child[2];
+    int n = childPairs(nodes, pair, child);
+    for (int i = 0; i < n; i++)
+        pairsBelow(nodes, child[i], levels - 1, below);
+}
+
+/////////////////////////////////////////////////////////////////////////
+// The first "levels" levels of the subtree at "pair" in van Emde Boas
+// order: the top half of those levels, then each subtree below it,
+// all recursively
+/////////////////////////////////////////////////////////////////////////
+static void orderVanEmdeBoas(const BVHNodeArray& nodes, int pair,
+                             int levels, vector<int>& order)
+{
+    if (levels == 1) {
+        order.push_back(pair);
+        return;
+    }
+
+    int top = levels / 2;
+    orderVanEmdeBoas(nodes, pair, top, order);
+
+    vector<int> below;
+    pairsBelow(nodes, pair, top, below);
+    for (int i = 0; i < (int)below.size(); i++)
+        orderVanEmdeBoas(nodes, below[i], levels - top, order);
+}
+
+/////////////////////////////////////////////////////////////////////////
+// Reorder the nodes of the built tree into "how"
+/////////////////////////////////////////////////////////////////////////
+void BVH::reorder(BVHLayout how)
+{
+    layout = how;
+    if (how == BVH_LAYOUT_BUILD || nodes.size() <= 2)
+        return;
+
+    int pairs = (int)nodes.size() / 2;
+    vector<int> order;
+    order.reserve(pairs);
+    if (how == BVH_LAYOUT_DFS)
+        orderDepthFirst(nodes, 0, order);
+    else
+        orderVanEmdeBoas(nodes, 0, pairHeight(nodes, 0), order);
+
+    vector<int> newPair(pairs);
+    for (int i = 0; i < pairs; i++)
+        newPair[order[i]] = i;
+
+    BVHNodeArray reordered(nodes.size());
+    for (int i = 0; i < pairs; i++) {
+        for (int k = 0; k < 2; k++) {
+            if (order[i] == 0 && k == 1)
+                continue;       // padding
+            BVHNode node = nodes[2 * order[i] + k];
+            if (!node.isLeaf())
+                node.first = 2 * newPair[node.first / 2];
+            reordered[2 * i + k] = node;
+        }
+    }
+    nodes.swap(reordered);
+    linkParents();
+}
@@ -0,0 +1,242 @@
+//
+// Packet traversal of the binary hierarchy (BVH::firstHits()).
+//
+// The rays of a packet walk the tree together, keeping the index of
+// the first ray that may still hit the current node: the rays before
+// it are known to miss.  A node is entered as soon as one ray hits
+// its box.  Before the rays are tried one by one, the whole packet is
+// tested at once by interval arithmetic: the ranges of the rays'
+// starts and reciprocal directions bound every ray's distances to the
+// box's slabs, and if those bounds miss the box (or lie beyond every
+// ray's closest hit) no ray can hit it (Wald, Boulos and Shirley,
+// "Ray Tracing Deformable Scenes Using Dynamic Bounding Volume
+// Hierarchies", ACM TOG 2007).  The leaves test their primitives
+// against all the rays from the first one on, with the primitives'
+// packet tests.
+//
+// The bounds need every ray to point into the same octant; packets
+// that don't are traced a ray at a time.
+//
+
+#include "BVH.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Deep enough for any tree the builders make
+static const int PACKET_STACK_SIZE = 128;
+
+//
+// The intervals that a packet's rays lie in, for the whole-packet
+// box test
+//
+struct PacketBounds {
+    int nearHi[3];          // 1 if the rays enter boxes through hi[]
+    float orgLo[3], orgHi[3];
+    float invLo[3], invHi[3];
+    bool bounded[3];        // false: some ray is parallel to the slabs
+    float tmax;             // the farthest of the rays' closest hits
+};
+
+//
+// Fill in "b"; false if the rays point into more than one octant
+//
+static bool packetBounds(const RayPacket& p, PacketBounds& b)
+{
+    const float *org[3] = {p.ox, p.oy, p.oz};
+    const float *inv[3] = {p.ix, p.iy, p.iz};
+
+    for (int a = 0; a < 3; a++) {
+        b.nearHi[a] = (inv[a][0] < 0);
+        b.orgLo[a] = b.orgHi[a] = org[a][0];
+        b.invLo[a] = b.invHi[a] = inv[a][0];
+        for (int i = 1; i < p.size; i++) {
+            if ((inv[a][i] < 0) != (b.nearHi[a] != 0))
+                return false;
+            b.orgLo[a] = min(b.orgLo[a], org[a][i]);
+            b.orgHi[a] = max(b.orgHi[a], org[a][i]);
+            b.invLo[a] = min(b.invLo[a], inv[a][i]);
+            b.invHi[a] = max(b.invHi[a], inv[a][i]);
+        }
+        b.bounded[a] = isfinite(b.invLo[a]) && isfinite(b.invHi[a]);
+    }
+    return true;
+}
+
+static float farthestHit(const RayPacket& p, int first)
+{
+    float t = 0;
+    for (int i = first; i < p.size; i++)
+        t = (p.tmax[i] > t) ? p.tmax[i] : t;
+    return t;
+}
+
+//
+// The slab test of BVH.cpp's hitsBox() for ray "i", with the near
+// planes known from the octant
+//
+static inline bool rayHitsBox(const RayPacket& p, int i, const BBox& box,
+                              const PacketBounds& b)
+{
+    const float org[3] = {p.ox[i], p.oy[i], p.oz[i]};
+    const float inv[3] = {p.ix[i], p.iy[i], p.iz[i]};
+    float t0 = 0;
+    float t1 = p.tmax[i];
+
+    for (int a = 0; a < 3; a++) {
+        float nearP = b.nearHi[a] ? box.hi[a] : box.lo[a];
+        float farP  = b.nearHi[a] ? box.lo[a] : box.hi[a];
+        float tNear = (nearP - org[a]) * inv[a];
+        float tFar  = (farP - org[a]) * inv[a];
+        tFar *= 1.0000004f;
+        t0 = tNear > t0 ? tNear : t0;
+        t1 = tFar  < t1 ? tFar  : t1;
+    }
+    return t0 <= t1;
+}
+
+//
+// true if no ray of the packet can hit "box".  Rounding only ever
+// moves a ray's distances within the bounds computed here from the
+// ends of the intervals, so the test never rejects a box that one of
+// the rays hits.
+//
+static inline bool packetMissesBox(const BBox& box, const PacketBounds& b)
+{
+    float t0 = 0;
+    float t1 = b.tmax;
+
+    for (int a = 0; a < 3; a++) {
+        if (!b.bounded[a])
+            continue;
+        float nearP = b.nearHi[a] ? box.hi[a] : box.lo[a];
+        float farP  = b.nearHi[a] ? box.lo[a] : box.hi[a];
+
+        // Every ray's (plane - start) * inverse lies between the
+        // products of the ends of the two intervals
+        float n0 = nearP - b.orgHi[a], n1 = nearP - b.orgLo[a];
+        float tNear = min(min(n0 * b.invLo[a], n0 * b.invHi[a]),
+                          min(n1 * b.invLo[a], n1 * b.invHi[a]));
+        float f0 = farP - b.orgHi[a], f1 = farP - b.orgLo[a];
+        float tFar = max(max(f0 * b.invLo[a], f0 * b.invHi[a]),
+                         max(f1 * b.invLo[a], f1 * b.invHi[a]));
+        tFar *= 1.0000004f;
+
+        t0 = tNear > t0 ? tNear : t0;
+        t1 = tFar  < t1 ? tFar  : t1;
+    }
+    return t0 > t1;
+}
+
+//
+// The first ray from "first" on that hits "box", or p.size if none
+//
+static inline int firstRayHitting(const RayPacket& p, int first,
+                                  const BBox& box, const PacketBounds& b)
+{
+    if (rayHitsBox(p, first, box, b))
+        return first;
+    if (packetMissesBox(box, b))
+        return p.size;
+    for (int i = first + 1; i < p.size; i++)
+        if (rayHitsBox(p, i, box, b))
+            return i;
+    return p.size;
+}
+
+/////////////////////////////////////////////////////////////////////////
+// Find the closest hit of each ray of the packet.  Node visits and
+// primitive tests count once per packet.
+/////////////////////////////////////////////////////////////////////////
+void BVH::firstHits(RayPacket& packet)
+{
+    if (nodes.empty() || packet.size == 0)
+        return;
+
+    PacketBounds bounds;
+    if (!packetBounds(packet, bounds)) {
+        for (int i = 0; i < packet.size; i++) {
+            Ray4 ray = packet.ray(i);
+            if (firstHit(ray, *packet.hit[i], packet.tmax[i])) {
+                packet.tmax[i] = packet.hit[i]->t;
+                packet.status[i] = PACKET_HIT;
+            }
+        }
+        return;
+    }
+    bounds.tmax = farthestHit(packet, 0);
+
+    traversal.rays += packet.size;
+
+    int n = packet.size;
+    int first = firstRayHitting(packet, 0, nodes[0].box, bounds);
+    if (first == n)
+        return;
+
+    int stackNode[PACKET_STACK_SIZE];
+    int stackFirst[PACKET_STACK_SIZE];
+    int sp = 0;
+
+    int node = 0;
+    int visited = 0;
+    int tested = 0;
+
+    for (;;) {
+        const BVHNode& nd = nodes[node];
+        visited++;
+
+        if (nd.isLeaf()) {
+            tested += nd.count;
+            primList.intersectsPacket(&prims[0], nd.first, nd.count, packet,
+                                      first);
+            bounds.tmax = farthestHit(packet, first);
+        }
+        else {
+            int fl = firstRayHitting(packet, first, nodes[nd.first].box, bounds);
+            int fr = firstRayHitting(packet, first, nodes[nd.first + 1].box, bounds);
+
+            if (fl < n && fr < n) {
+                // Nearer child first, as seen along the first ray
+                int f = min(fl, fr);
+                const BBox& l = nodes[nd.first].box;
+                const BBox& r = nodes[nd.first + 1].box;
+                float along = (l.center(0) - r.center(0)) * packet.dx[f] +
+                              (l.center(1) - r.center(1)) * packet.dy[f] +
+                              (l.center(2) - r.center(2)) * packet.dz[f];
+                bool leftFirst = (along <= 0);
+
+                stackNode[sp] = leftFirst ? nd.first + 1 : nd.first;
+                stackFirst[sp] = leftFirst ? fr : fl;
+                sp++;
+                node = leftFirst ? nd.first : nd.first + 1;
+                first = leftFirst ? fl : fr;
+                continue;
+            }
+            if (fl < n) {
+                node = nd.first;
+                first = fl;
+                continue;
+            }
+            if (fr < n) {
+                node = nd.first + 1;
+                first = fr;
+                continue;
+            }
+        }
+
+        // Pop the next subtree that some ray still hits, now that the
+        // rays may have found closer hits
+        do {
+            if (sp == 0) {
+                traversal.nodes += visited;
+                traversal.prims += tested;
+                return;
+            }
+            sp--;
+            node = stackNode[sp];
+            bounds.tmax = farthestHit(packet, stackFirst[sp]);
+            first = firstRayHitting(packet, stackFirst[sp], nodes[node].box,
+                                    bounds);
+        } while (first == n);
+    }
+}
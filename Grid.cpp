@@ -0,0 +1,384 @@
+#include "Grid.h"
+#include "RayQuery.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+
+// About this many cells per object, in the top level and in the
+// refined cells
+static const float GRID_DENSITY = 2.0f;
+static const float SUB_GRID_DENSITY = 2.0f;
+
+// Cells per axis, at most
+static const int MAX_RESOLUTION = 256;
+static const int MAX_SUB_RESOLUTION = 16;
+
+// Cells of the top level holding more objects than this are refined
+static const int REFINE_THRESHOLD = 16;
+
+// Large objects are listed in every cell they overlap.  Levels whose
+// objects would average more cells than this get coarser cells.
+static const int MAX_CELLS_PER_OBJECT = 8;
+
+Grid::Grid()
+{
+    buildMillis = 0;
+}
+
+// The cell of one coordinate along one axis of a level
+static inline int cellOf(const GridLevel& g, int axis, float v)
+{
+    int c = (int)((v - g.box.lo[axis]) * g.invCellSize[axis]);
+    return max(0, min(c, g.res[axis] - 1));
+}
+
+/////////////////////////////////////////////////////////////////////////
+// Build the grid over "objects"
+/////////////////////////////////////////////////////////////////////////
+void Grid::build(vector<Object*>& objs)
+{
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    objects = objs;
+    levels.clear();
+    if (objects.empty())
+        return;
+
+    int n = (int)objects.size();
+    BBox sceneBox;
+    bounds.resize(n);
+    vector<int> all(n);
+    for (int i = 0; i < n; i++) {
+        bounds[i] = objects[i]->bounds();
+        sceneBox.grow(bounds[i]);
+        all[i] = i;
+    }
+
+    levels.resize(1);
+    levels[0].box = sceneBox;
+    buildLevel(0, all, GRID_DENSITY, MAX_RESOLUTION);
+
+    // Refine the crowded cells, each into a grid over its own objects
+    // (clipped to the cell)
+    int cells = (int)levels[0].sub.size();
+    for (int c = 0; c < cells; c++) {
+        const GridLevel& top = levels[0];
+        int first = top.start[c];
+        int count = top.start[c+1] - first;
+        if (count <= REFINE_THRESHOLD)
+            continue;
+
+        vector<int> members(top.items.begin() + first,
+                            top.items.begin() + first + count);
+
+        int cell[3] = {c % top.res[0],
+                       (c / top.res[0]) % top.res[1],
+                       c / (top.res[0] * top.res[1])};
+        BBox cellBox;
+        for (int a = 0; a < 3; a++) {
+            cellBox.lo[a] = top.box.lo[a] + cell[a] * top.cellSize[a];
+            cellBox.hi[a] = (cell[a] == top.res[a] - 1)
+                ? top.box.hi[a]
+                : top.box.lo[a] + (cell[a] + 1) * top.cellSize[a];
+        }
+        BBox box;
+        for (int i = 0; i < count; i++)
+            box.grow(bounds[members[i]]);
+        box.clip(cellBox);
+        if (box.isEmpty())
+            continue;
+
+        int index = (int)levels.size();
+        levels.resize(index + 1);
+        levels[index].box = box;
+        buildLevel(index, members, SUB_GRID_DENSITY, MAX_SUB_RESOLUTION);
+
+        // Objects too big to be told apart by a finer grid
+        if (levels[index].sub.size() == 1) {
+            levels.pop_back();
+            continue;
+        }
+        levels[0].sub[c] = index;
+    }
+
+    vector<BBox>().swap(bounds);
+
+    buildMillis = chrono::duration<double, milli>(
+                      chrono::steady_clock::now() - start).count();
+}
+
+/////////////////////////////////////////////////////////////////////////
+// Cut levels[level].box into about density * (number of members)
+// cubical cells (fewer if the members are big enough to be listed in
+// too many), and list the members overlapping each cell: count them
+// per cell, turn the counts into offsets, then fill in.
+/////////////////////////////////////////////////////////////////////////
+void Grid::buildLevel(int level, const vector<int>& members, float density,
+                      int maxRes)
+{
+    GridLevel& g = levels[level];
+    int m = (int)members.size();
+
+    // Cells per unit length, from the volume; flat boxes are treated
+    // as a little thicker than they are
+    float extent[3];
+    float maxExtent = 0;
+    for (int a = 0; a < 3; a++) {
+        extent[a] = g.box.hi[a] - g.box.lo[a];
+        maxExtent = max(maxExtent, extent[a]);
+    }
+    float volume = 1;
+    for (int a = 0; a < 3; a++)
+        volume *= max(extent[a], 1e-3f * maxExtent);
+    float perUnit = (volume > 0) ? cbrtf(density * m / volume) : 0;
+
+    int res[3];
+    for (int a = 0; a < 3; a++)
+        res[a] = max(1, min((int)(extent[a] * perUnit + 0.5f), maxRes));
+
+    int cells;
+    for (;;) {
+        cells = 1;
+        for (int a = 0; a < 3; a++) {
+            g.res[a] = res[a];
+            g.cellSize[a] = extent[a] / res[a];
+            g.invCellSize[a] = (extent[a] > 0) ? res[a] / extent[a] : 0;
+            cells *= res[a];
+        }
+        if (cells == 1)
+            break;
+
+        double references = 0;
+        for (int i = 0; i < m; i++) {
+            const BBox& b = bounds[members[i]];
+            double span = 1;
+            for (int a = 0; a < 3; a++)
+                span *= cellOf(g, a, b.hi[a]) - cellOf(g, a, b.lo[a]) + 1;
+            references += span;
+        }
+        if (references <= (double)MAX_CELLS_PER_OBJECT * m)
+            break;
+
+        for (int a = 0; a < 3; a++)
+            res[a] = max(1, res[a] / 2);
+    }
+
+    // start[c+1] counts the members of cell c, then becomes an offset
+    g.start.assign(cells + 1, 0);
+    for (int i = 0; i < m; i++) {
+        const BBox& b = bounds[members[i]];
+        int lo[3], hi[3];
+        for (int a = 0; a < 3; a++) {
+            lo[a] = cellOf(g, a, b.lo[a]);
+            hi[a] = cellOf(g, a, b.hi[a]);
+        }
+        for (int z = lo[2]; z <= hi[2]; z++)
+            for (int y = lo[1]; y <= hi[1]; y++)
+                for (int x = lo[0]; x <= hi[0]; x++)
+                    g.start[x + g.res[0] * (y + g.res[1] * z) + 1]++;
+    }
+    for (int c = 0; c < cells; c++)
+        g.start[c+1] += g.start[c];
+
+    g.items.resize(g.start[cells]);
+    vector<int> fill(g.start.begin(), g.start.end() - 1);
+    for (int i = 0; i < m; i++) {
+        const BBox& b = bounds[members[i]];
+        int lo[3], hi[3];
+        for (int a = 0; a < 3; a++) {
+            lo[a] = cellOf(g, a, b.lo[a]);
+            hi[a] = cellOf(g, a, b.hi[a]);
+        }
+        for (int z = lo[2]; z <= hi[2]; z++)
+            for (int y = lo[1]; y <= hi[1]; y++)
+                for (int x = lo[0]; x <= hi[0]; x++)
+                    g.items[fill[x + g.res[0] * (y + g.res[1] * z)]++] = members[i];
+    }
+
+    g.sub.assign(cells, -1);
+}
+
+void Grid::startRay(Ray4& ray, GridRay& r) const
+{
+    r.ray = &ray;
+    for (int a = 0; a < 3; a++) {
+        r.org[a] = ray.start[a];
+        r.dir[a] = ray.direction[a];
+        r.inv[a] = 1.0f / r.dir[a];
+    }
+    for (int i = 0; i < GRID_MAILBOX_SIZE; i++)
+        r.mailbox[i] = -1;
+    r.cells = 0;
+    r.tests = 0;
+}
+
+/////////////////////////////////////////////////////////////////////////
+// Find the closest object hit by the ray with t < tmax
+/////////////////////////////////////////////////////////////////////////
+bool Grid::firstHit(Ray4& ray, Hit& hit, float tmax)
+{
+    if (levels.empty())
+        return false;
+
+    GridRay r;
+    startRay(ray, r);
+    ClosestHitQuery query(hit);
+
+    bool found = traverse(0, r, query, 0, tmax);
+
+    traversal.rays++;
+    traversal.nodes += r.cells;
+    traversal.prims += r.tests;
+    return found;
+}
+
+/////////////////////////////////////////////////////////////////////////
+// Is anything hit with tmin <= t < tmax?  Walks the cells from tmin on.
+/////////////////////////////////////////////////////////////////////////
+bool Grid::anyHit(Ray4& ray, float tmin, float tmax)
+{
+    if (levels.empty())
+        return false;
+
+    GridRay r;
+    startRay(ray, r);
+    AnyHitQuery query(tmin);
+
+    bool found = traverse(0, r, query, max(tmin, 0.0f), tmax);
+
+    traversal.rays++;
+    traversal.nodes += r.cells;
+    traversal.prims += r.tests;
+    return found;
+}
+
+/////////////////////////////////////////////////////////////////////////
+// Walk the cells of one level that the ray crosses between tmin and
+// tmax, in order.  An object found in one cell may be hit beyond it,
+// so the walk goes on until the closest hit so far lies before the
+// end of the current cell.  Lowers tmax to the closest hit.  An
+// any-hit query (see RayQuery.h) stops at the first object hit.
+/////////////////////////////////////////////////////////////////////////
+template <class Query>
+bool Grid::traverse(int level, GridRay& r, Query& query, float tmin,
+                    float& tmax)
+{
+    const GridLevel& g = levels[level];
+    const float *org = r.org;
+    const float *dir = r.dir;
+    const float *inv = r.inv;
+
+    // Clip [tmin, tmax] to the level's box
+    float t0 = tmin;
+    float t1 = tmax;
+    for (int a = 0; a < 3; a++) {
+        float tNear = (g.box.lo[a] - org[a]) * inv[a];
+        float tFar  = (g.box.hi[a] - org[a]) * inv[a];
+        if (tNear > tFar)
+            swap(tNear, tFar);
+        tFar *= 1.0000004f;
+        t0 = tNear > t0 ? tNear : t0;
+        t1 = tFar  < t1 ? tFar  : t1;
+        if (t0 > t1)
+            return false;
+    }
+
+    // The starting cell, and where the ray leaves it along each axis
+    int cell[3], step[3], stop[3];
+    float tNext[3], tDelta[3];
+    for (int a = 0; a < 3; a++) {
+        cell[a] = cellOf(g, a, org[a] + t0 * dir[a]);
+        if (dir[a] > 0) {
+            step[a] = 1;
+            stop[a] = g.res[a];
+            tNext[a] = (g.box.lo[a] + (cell[a] + 1) * g.cellSize[a] - org[a]) * inv[a];
+            tDelta[a] = g.cellSize[a] * inv[a];
+        }
+        else if (dir[a] < 0) {
+            step[a] = -1;
+            stop[a] = -1;
+            tNext[a] = (g.box.lo[a] + cell[a] * g.cellSize[a] - org[a]) * inv[a];
+            tDelta[a] = -g.cellSize[a] * inv[a];
+        }
+        else {
+            step[a] = 0;
+            stop[a] = -1;
+            tNext[a] = FLT_MAX;
+            tDelta[a] = 0;
+        }
+    }
+
+    bool found = false;
+    float tEnter = t0;
+
+    for (;;) {
+        int axis = (tNext[0] < tNext[1])
+            ? ((tNext[0] < tNext[2]) ? 0 : 2)
+            : ((tNext[1] < tNext[2]) ? 1 : 2);
+        float tExit = tNext[axis];
+        int c = cell[0] + g.res[0] * (cell[1] + g.res[1] * cell[2]);
+        r.cells++;
+
+        if (g.sub[c] >= 0) {
+            if (traverse(g.sub[c], r, query, tEnter, tmax)) {
+                if (Query::anyHit)
+                    return true;
+                found = true;
+            }
+        }
+        else {
+            for (int i = g.start[c]; i < g.start[c+1]; i++) {
+                int item = g.items[i];
+                int& slot = r.mailbox[item & (GRID_MAILBOX_SIZE - 1)];
+                if (slot == item)
+                    continue;
+                slot = item;
+                r.tests++;
+                if (queryObject(query, objects[item], *r.ray, tmax)) {
+                    if (Query::anyHit)
+                        return true;
+                    found = true;
+                }
+            }
+        }
+
+        if (tmax <= tExit || tExit >= t1)
+            return found;
+
+        cell[axis] += step[axis];
+        if (cell[axis] == stop[axis])
+            return found;
+        tEnter = tExit;
+        tNext[axis] += tDelta[axis];
+    }
+}
+
+size_t Grid::memoryBytes() const
+{
+    size_t bytes = 0;
+    for (int i = 0; i < (int)levels.size(); i++)
+        bytes += (levels[i].start.size() + levels[i].sub.size() +
+                  levels[i].items.size()) * sizeof(int);
+    return bytes;
+}
+
+void Grid::printStats(ostream& os) const
+{
+    if (levels.empty()) {
+        os << "Grid: empty" << endl;
+        return;
+    }
+
+    const GridLevel& top = levels[0];
+    size_t items = 0;
+    for (int i = 0; i < (int)levels.size(); i++)
+        items += levels[i].items.size();
+    size_t bytes = memoryBytes();
+
+    os << "Grid: " << top.res[0] << "x" << top.res[1] << "x" << top.res[2]
+       << " cells, " << levels.size() - 1 << " refined, "
+       << (double)items / objects.size() << " references/object, "
+       << bytes / 1024 << " KB, " << buildMillis << " ms" << endl;
+}
@@ -2,16 +2,35 @@
 #define _HIT_H_
 
 #include "GeomLib.h"
-#include "Material.h"
 
+class Object;
+
+//
+// What a ray hits, as the traversals keep track of it: how far along
+// the ray, which primitive, and where on it.  Candidates that a closer
+// hit replaces cost no more than this; the surface at the hit (see
+// Surface) is worked out once, for the closest one.
+//
 class Hit {
 public:
-    Point4 hit_point;
-    Vector4 normal;
-    Material material;
     float t;
+    Object *object;     // the scene object hit
+    Object *part;       // the primitive hit: "object" itself, or the
+                        // triangle of an instance's mesh
+    float u, v;         // barycentric coordinates of the hit on a
+                        // triangle (along its edges e1 and e2)
 
     Hit();
 };
 
+//
+// The surface where a ray hit, from Object::getSurface()
+//
+class Surface {
+public:
+    Point4 hit_point;
+    Vector4 normal;
+    int material;       // index into the scene's material list
+};
+
 #endif
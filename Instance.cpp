@@ -0,0 +1,142 @@
+#include "Instance.h"
+
+// Instances take their materials from the mesh's triangles
+Instance::Instance(Mesh *m, const Matrix4& transform) {
+
+    mesh = m;
+    setTransform(transform);
+}
+
+//
+// The mesh must be built by now: its box is taken to world
+// coordinates here
+//
+void Instance::setTransform(const Matrix4& transform) {
+    toWorld = transform;
+    toObject = transform.inverse();
+
+    BBox local = mesh->bounds();
+    box = BBox();
+    if (local.isEmpty())
+        return;
+
+    // The box around the mesh box's eight corners
+    for (int i = 0; i < 8; i++) {
+        Point4 corner((i & 1) ? local.hi[0] : local.lo[0],
+                      (i & 2) ? local.hi[1] : local.lo[1],
+                      (i & 4) ? local.hi[2] : local.lo[2]);
+        Point4 p;
+        toWorld.times(corner, p);
+        box.grow(p);
+    }
+}
+
+//
+// The ray's direction is transformed but not renormalized, so t is
+// the same in both coordinate systems.  The record keeps the mesh's
+// triangle as its part.
+//
+bool Instance::intersects(Ray4& ray, Hit& hit) {
+    Ray4 local;
+    toObject.times(ray.start, local.start);
+    toObject.times(ray.direction, local.direction);
+
+    Hit h;
+    if (!mesh->firstHit(local, h, FLT_MAX))
+        return false;
+
+    hit = h;
+    hit.object = this;
+    return true;
+}
+
+//
+// Slab test of ray "i" of "packet" against "box"
+//
+static inline bool rayHitsBox(const RayPacket& packet, int i,
+                              const BBox& box)
+{
+    const float org[3] = {packet.ox[i], packet.oy[i], packet.oz[i]};
+    const float inv[3] = {packet.ix[i], packet.iy[i], packet.iz[i]};
+    float t0 = 0;
+    float t1 = packet.tmax[i];
+
+    for (int a = 0; a < 3; a++) {
+        float tNear = (box.lo[a] - org[a]) * inv[a];
+        float tFar  = (box.hi[a] - org[a]) * inv[a];
+        if (tNear > tFar)
+            swap(tNear, tFar);
+        tFar *= 1.0000004f;
+        t0 = tNear > t0 ? tNear : t0;
+        t1 = tFar  < t1 ? tFar  : t1;
+    }
+    return t0 <= t1;
+}
+
+//
+// The rays of the packet that hit the instance's box are taken to
+// object coordinates as a packet of their own and traced through the
+// mesh's hierarchy together, into the packet's hit records.
+//
+void Instance::intersectsPacket(RayPacket& packet, int first) {
+    RayPacket local;
+    int lane[PACKET_MAX_RAYS];
+
+    for (int i = first; i < packet.size; i++) {
+        if (!rayHitsBox(packet, i, box))
+            continue;
+        Ray4 ray = packet.ray(i);
+        Ray4 r;
+        toObject.times(ray.start, r.start);
+        toObject.times(ray.direction, r.direction);
+        lane[local.size] = i;
+        local.add(r, packet.tmax[i], packet.hit[i]);
+    }
+    if (local.size == 0)
+        return;
+
+    mesh->firstHits(local);
+    local.record();
+
+    for (int j = 0; j < local.size; j++) {
+        if (local.status[j] != PACKET_HIT)
+            continue;
+        int i = lane[j];
+        packet.hit[i]->object = this;
+        packet.tmax[i] = local.tmax[j];
+        packet.status[i] = PACKET_HIT;
+        packet.object[i] = this;
+    }
+}
+
+//
+// The triangle's surface, in object coordinates, taken to world
+// coordinates: normals go through the transpose of the inverse
+//
+void Instance::getSurface(Ray4& ray, const Hit& hit, Surface& surface) {
+    Ray4 local;
+    toObject.times(ray.start, local.start);
+    toObject.times(ray.direction, local.direction);
+
+    Surface s;
+    hit.part->getSurface(local, hit, s);
+
+    Vector4 n;
+    toObject.transpose().times(s.normal, n);
+    n.W() = 0;
+
+    toWorld.times(s.hit_point, surface.hit_point);
+    surface.normal = n.normalized();
+    surface.material = s.material;
+}
+
+bool Instance::occludes(Ray4& ray, float tmin, float tmax) {
+    Ray4 local;
+    toObject.times(ray.start, local.start);
+    toObject.times(ray.direction, local.direction);
+    return mesh->anyHit(local, tmin, tmax);
+}
+
+BBox Instance::bounds() {
+    return box;
+}
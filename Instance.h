@@ -0,0 +1,41 @@
+#if !defined(_INSTANCE_H_)
+
+#define _INSTANCE_H_
+
+#include "GeomLib.h"
+#include "Hit.h"
+#include "Mesh.h"
+#include "Object.h"
+
+//
+// One placement of a shared Mesh in the scene.  Rays are taken into
+// the mesh's coordinates and traced through the mesh's own hierarchy,
+// so a mesh placed a thousand times is stored once; each instance
+// only adds its transforms.
+//
+class Instance : public Object {
+public:
+    //
+    // Place "mesh" with the object-to-world transform "toWorld"
+    //
+    Instance(Mesh *mesh, const Matrix4& toWorld);
+    ObjectType getType() const {return INSTANCE;};
+    bool intersects(Ray4& ray, Hit& hit);
+    bool occludes(Ray4& ray, float tmin, float tmax);
+    void intersectsPacket(RayPacket& packet, int first);
+    void getSurface(Ray4& ray, const Hit& hit, Surface& surface);
+    BBox bounds();
+
+    // Moving an instance: call BVH::update() afterwards
+    const Matrix4& getTransform() const {return toWorld;};
+    Mesh *getMesh() const {return mesh;};
+    void setTransform(const Matrix4& toWorld);
+
+private:
+    Mesh *mesh;
+    Matrix4 toWorld;    // object to world
+    Matrix4 toObject;   // world to object, its inverse
+    BBox box;           // bounds(), kept from the last setTransform()
+};
+
+#endif
@@ -0,0 +1,55 @@
+#include "Isa.h"
+
+static const char *ISA_NAMES[] = {"scalar", "sse4.2", "avx2", "avx512"};
+
+static const int ISA_UNSET = -1;
+static int chosenIsa = ISA_UNSET;
+
+/////////////////////////////////////////////////////////////////////////
+// __builtin_cpu_supports() also checks that the operating system saves
+// the wider registers, so a level found here is safe to run.
+/////////////////////////////////////////////////////////////////////////
+IsaLevel hostIsa()
+{
+#if defined(__x86_64__) && defined(__GNUC__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return ISA_AVX512;
+    if (__builtin_cpu_supports("avx2"))
+        return ISA_AVX2;
+    if (__builtin_cpu_supports("sse4.2"))
+        return ISA_SSE42;
+#endif
+    return ISA_SCALAR;
+}
+
+IsaLevel activeIsa()
+{
+    if (chosenIsa == ISA_UNSET)
+        chosenIsa = hostIsa();
+    return (IsaLevel)chosenIsa;
+}
+
+bool setIsa(IsaLevel level)
+{
+    if (level > hostIsa())
+        return false;
+    chosenIsa = level;
+    return true;
+}
+
+const char *isaName(IsaLevel level)
+{
+    return ISA_NAMES[level];
+}
+
+bool isaByName(const string& name, IsaLevel& level)
+{
+    for (int i = ISA_SCALAR; i <= ISA_AVX512; i++) {
+        if (name == ISA_NAMES[i]) {
+            level = (IsaLevel)i;
+            return true;
+        }
+    }
+    return false;
+}
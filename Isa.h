@@ -0,0 +1,38 @@
+#if !defined(_ISA_H_)
+
+#define _ISA_H_
+
+#include <string>
+
+using namespace std;
+
+//
+// The instruction set levels the vector kernels are built for, from
+// narrowest to widest.  Each kernel file is compiled for its own level
+// (see Makefile.linux), and the kernels in use are chosen at run time:
+// the widest level that the processor runs, unless --isa= asks for a
+// narrower one.
+//
+enum IsaLevel {ISA_SCALAR, ISA_SSE42, ISA_AVX2, ISA_AVX512};
+
+// The widest level this processor (and its operating system) runs
+IsaLevel hostIsa();
+
+// The level the kernels are chosen for: hostIsa(), or that set below
+IsaLevel activeIsa();
+
+//
+// Choose the kernels for "level" instead.  Call before anything is
+// traced.  false if the processor can't run that level, which leaves
+// the choice as it was.
+//
+bool setIsa(IsaLevel level);
+
+//
+// Names, as --isa= takes them: "scalar", "sse4.2", "avx2", "avx512".
+// isaByName() returns false for a name it doesn't know.
+//
+const char *isaName(IsaLevel level);
+bool isaByName(const string& name, IsaLevel& level);
+
+#endif
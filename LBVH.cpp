@@ -0,0 +1,265 @@
+//////////////////////////////////////////////////////
+//
+// Linear BVH builder (Karras, "Maximizing Parallelism
+// in the Construction of BVHs, Octrees, and k-d Trees",
+// HPG 2012).
+//
+// Primitives are sorted along a Morton curve through
+// their centroids; the hierarchy then falls out of the
+// common prefixes of neighbouring codes, and every
+// interior node can be emitted independently.
+//
+//////////////////////////////////////////////////////
+
+#include "BVH.h"
+#include "Parallel.h"
+
+#include <atomic>
+#include <cfloat>
+#include <cstdint>
+#include <memory>
+
+// Below this many primitives 10 bits per axis (30-bit codes, four
+// radix passes) are enough; above it use 21 bits per axis (63-bit
+// codes, eight passes) so that fewer centroids share a code.
+static const int LONG_CODE_THRESHOLD = 1 << 18;
+
+static const int RADIX_BITS = 8;
+static const int RADIX = 1 << RADIX_BITS;
+
+// Spread the low 10 bits of x so that there are two zeros
+// between each pair of bits.
+static inline uint64_t spread10(uint64_t x)
+{
+    x &= 0x3ff;
+    x = (x | (x << 16)) & 0x030000ff;
+    x = (x | (x <<  8)) & 0x0300f00f;
+    x = (x | (x <<  4)) & 0x030c30c3;
+    x = (x | (x <<  2)) & 0x09249249;
+    return x;
+}
+
+// The same, for the low 21 bits of x
+static inline uint64_t spread21(uint64_t x)
+{
+    x &= 0x1fffff;
+    x = (x | (x << 32)) & 0x001f00000000ffffULL;
+    x = (x | (x << 16)) & 0x001f0000ff0000ffULL;
+    x = (x | (x <<  8)) & 0x100f00f00f00f00fULL;
+    x = (x | (x <<  4)) & 0x10c30c30c30c30c3ULL;
+    x = (x | (x <<  2)) & 0x1249249249249249ULL;
+    return x;
+}
+
+//
+// Stable LSD radix sort of (key, value) pairs on the low "bits" bits
+// of the keys.  Each pass histograms and scatters one chunk per thread.
+//
+static void radixSort(vector<uint64_t>& keys, vector<int>& values, int bits)
+{
+    int n = (int)keys.size();
+    int chunks = workerCount();
+
+    vector<uint64_t> keys2(n);
+    vector<int> values2(n);
+    vector<int> counts(chunks * RADIX);
+
+    for (int shift = 0; shift < bits; shift += RADIX_BITS) {
+        fill(counts.begin(), counts.end(), 0);
+
+        parallelFor(n, [&](int c, int begin, int end) {
+            int *count = &counts[c * RADIX];
+            for (int i = begin; i < end; i++)
+                count[(keys[i] >> shift) & (RADIX - 1)]++;
+        });
+
+        // Turn the counts into starting offsets: digit-major, so that
+        // within one digit earlier chunks come first (stability).
+        int sum = 0;
+        bool trivial = false;
+        for (int d = 0; d < RADIX; d++) {
+            int digitTotal = 0;
+            for (int c = 0; c < chunks; c++) {
+                int k = counts[c * RADIX + d];
+                counts[c * RADIX + d] = sum;
+                sum += k;
+                digitTotal += k;
+            }
+            if (digitTotal == n)
+                trivial = true;     // every key has this digit
+        }
+        if (trivial)
+            continue;
+
+        parallelFor(n, [&](int c, int begin, int end) {
+            int *offset = &counts[c * RADIX];
+            for (int i = begin; i < end; i++) {
+                int dst = offset[(keys[i] >> shift) & (RADIX - 1)]++;
+                keys2[dst] = keys[i];
+                values2[dst] = values[i];
+            }
+        });
+
+        keys.swap(keys2);
+        values.swap(values2);
+    }
+}
+
+//
+// Length of the common prefix of the codes at i and j, or -1 if j is
+// outside the array.  Equal codes are told apart by their index.
+//
+static inline int delta(const vector<uint64_t>& codes, int i, int j)
+{
+    if (j < 0 || j >= (int)codes.size())
+        return -1;
+    if (codes[i] == codes[j])
+        return 64 + __builtin_clz((unsigned)(i ^ j));
+    return __builtin_clzll(codes[i] ^ codes[j]);
+}
+
+/////////////////////////////////////////////////////////////////////////
+// Linear BVH build.  Interior node k of the Karras tree (0 is the root)
+// lives at nodes[0] for k == 0, and its children at nodes[2+2k] and
+// nodes[3+2k]; so the n-1 interior nodes and n leaves fill exactly 2n
+// slots, and each node's slot is known before the tree is.
+/////////////////////////////////////////////////////////////////////////
+void BVH::buildLinear(BVHBuildState& state)
+{
+    vector<BVHBuildRef>& refs = state.refs;
+    int n = (int)refs.size();
+
+    if (n == 1) {
+        nodes[0].box = refs[0].box;
+        makeLeaf(0, 0, 1);
+        return;
+    }
+
+    // Quantize centroids against the bounds of all centroids
+    float clo[3] = { FLT_MAX,  FLT_MAX,  FLT_MAX};
+    float chi[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+    for (int i = 0; i < n; i++) {
+        for (int a = 0; a < 3; a++) {
+            float c = refs[i].c[a];
+            clo[a] = (c < clo[a]) ? c : clo[a];
+            chi[a] = (c > chi[a]) ? c : chi[a];
+        }
+    }
+
+    int axisBits = (n < LONG_CODE_THRESHOLD) ? 10 : 21;
+    float cells = (float)((1 << axisBits) - 1);
+    float scale[3];
+    for (int a = 0; a < 3; a++) {
+        float extent = chi[a] - clo[a];
+        scale[a] = (extent > 0) ? cells / extent : 0;
+    }
+
+    vector<uint64_t> codes(n);
+    vector<int> order(n);
+    parallelFor(n, [&](int c, int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            uint64_t q[3];
+            for (int a = 0; a < 3; a++)
+                q[a] = (uint64_t)((refs[i].c[a] - clo[a]) * scale[a]);
+            codes[i] = (axisBits == 10)
+                ? (spread10(q[0]) << 2) | (spread10(q[1]) << 1) | spread10(q[2])
+                : (spread21(q[0]) << 2) | (spread21(q[1]) << 1) | spread21(q[2]);
+            order[i] = i;
+        }
+    });
+
+    radixSort(codes, order, 3 * axisBits);
+
+    vector<BVHBuildRef> sorted(n);
+    for (int i = 0; i < n; i++)
+        sorted[i] = refs[order[i]];
+    refs.swap(sorted);
+
+    // Emit every interior node at once.  parent[s] is the interior node
+    // whose child sits in slot s; leafSlot[k] is where leaf k went.
+    vector<int> parent(2 * n);
+    vector<int> leafSlot(n);
+    vector<int> innerSlot(n - 1);
+    innerSlot[0] = 0;
+
+    parallelFor(n - 1, [&](int c, int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            // Direction of the range, and its other end j
+            int d = (delta(codes, i, i + 1) > delta(codes, i, i - 1)) ? 1 : -1;
+            int deltaMin = delta(codes, i, i - d);
+
+            int lmax = 2;
+            while (delta(codes, i, i + lmax * d) > deltaMin)
+                lmax *= 2;
+            int l = 0;
+            for (int t = lmax / 2; t >= 1; t /= 2)
+                if (delta(codes, i, i + (l + t) * d) > deltaMin)
+                    l += t;
+            int j = i + l * d;
+
+            // Split position gamma: the last code sharing the
+            // range's longer prefix on i's side
+            int deltaNode = delta(codes, i, j);
+            int s = 0;
+            for (int div = 2, t = (l + 1) / 2; ; div *= 2, t = (l + div - 1) / div) {
+                if (delta(codes, i, i + (s + t) * d) > deltaNode)
+                    s += t;
+                if (t <= 1)
+                    break;
+            }
+            int gamma = i + s * d + (d < 0 ? -1 : 0);
+
+            int left = 2 + 2 * i;
+            int right = left + 1;
+            parent[left] = parent[right] = i;
+
+            if ((i < j ? i : j) == gamma) {
+                makeLeaf(left, gamma, gamma + 1);
+                leafSlot[gamma] = left;
+            }
+            else {
+                nodes[left].first = 2 + 2 * gamma;
+                nodes[left].count = 0;
+                innerSlot[gamma] = left;
+            }
+
+            if ((i > j ? i : j) == gamma + 1) {
+                makeLeaf(right, gamma + 1, gamma + 2);
+                leafSlot[gamma + 1] = right;
+            }
+            else {
+                nodes[right].first = 2 + 2 * (gamma + 1);
+                nodes[right].count = 0;
+                innerSlot[gamma + 1] = right;
+            }
+        }
+    });
+    nodes[0].first = 2;
+    nodes[0].count = 0;
+
+    // Fit the boxes bottom-up.  Of the two threads arriving at an
+    // interior node, the second one (whose sibling is done) carries on.
+    unique_ptr<atomic<int>[]> visits(new atomic<int>[n - 1]);
+    for (int i = 0; i < n - 1; i++)
+        visits[i] = 0;
+
+    parallelFor(n, [&](int c, int begin, int end) {
+        for (int k = begin; k < end; k++) {
+            int slot = leafSlot[k];
+            nodes[slot].box = refs[k].box;
+
+            while (slot != 0) {
+                int i = parent[slot];
+                if (visits[i].fetch_add(1, memory_order_acq_rel) == 0)
+                    break;
+                int self = innerSlot[i];
+                BBox box = nodes[2 + 2 * i].box;
+                box.grow(nodes[3 + 2 * i].box);
+                nodes[self].box = box;
+                slot = self;
+            }
+        }
+    });
+
+    state.nextNode = 2 * n;
+}
@@ -10,7 +10,3 @@ Material::Material(Color& ambient, Color& diffuse, Color& specular, int shinines
 	this->ks = specular;
 	this->n = shininess;
 }
-
-
-
-
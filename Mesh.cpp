@@ -0,0 +1,22 @@
+#include "Mesh.h"
+
+Mesh::Mesh(const string& meshName)
+{
+    name = meshName;
+}
+
+void Mesh::build(BVHBuildMethod method, int optimizePasses, BVHLayout layout,
+                 BVHTraversal traversal)
+{
+    bvh.setOptimizePasses(optimizePasses);
+    bvh.setLayout(layout);
+    bvh.setTraversal(traversal);
+    bvh.build(objects, method);
+}
+
+BBox Mesh::bounds() const
+{
+    if (bvh.isEmpty())
+        return BBox();
+    return bvh.getNodes()[0].box;
+}
@@ -0,0 +1,68 @@
+#if !defined(_MESH_H_)
+
+#define _MESH_H_
+
+#include <string>
+#include <vector>
+
+#include "BBox.h"
+#include "BVH.h"
+#include "GeomLib.h"
+#include "Hit.h"
+#include "Object.h"
+
+//
+// A set of triangles that is defined once in the scene file and placed
+// any number of times by Instance objects.  The triangles are kept in
+// the mesh's own (object) coordinates, under a hierarchy of their own:
+// the bottom level of the scene's two-level hierarchy.
+//
+class Mesh {
+public:
+    Mesh(const string& name);
+
+    //
+    // Add a triangle (or any object); call build() when done
+    //
+    void add(Object *object) {objects.push_back(object);};
+
+    //
+    // Build the hierarchy over everything added so far, run
+    // "optimizePasses" rounds of BVH::optimize() on it, lay its
+    // nodes out in "layout" and walk them with "traversal"
+    //
+    void build(BVHBuildMethod method = BVH_BINNED, int optimizePasses = 0,
+               BVHLayout layout = BVH_LAYOUT_BUILD,
+               BVHTraversal traversal = BVH_TRAVERSE_STACK);
+
+    //
+    // Find the closest object hit by "ray" (in object coordinates)
+    // with t < tmax
+    //
+    bool firstHit(Ray4& ray, Hit& hit, float tmax) {
+        return bvh.firstHit(ray, hit, tmax);
+    };
+
+    // firstHit() for each ray of "packet" (in object coordinates)
+    void firstHits(RayPacket& packet) {bvh.firstHits(packet);};
+
+    // true iff "ray" hits anything with tmin <= t < tmax
+    bool anyHit(Ray4& ray, float tmin, float tmax) {
+        return bvh.anyHit(ray, tmin, tmax);
+    };
+
+    //
+    // Box around the whole mesh, in object coordinates
+    //
+    BBox bounds() const;
+
+    const string& getName() const {return name;};
+    int size() const {return (int)objects.size();};
+
+private:
+    string name;
+    vector<Object*> objects;
+    BVH bvh;
+};
+
+#endif
@@ -1,6 +1,36 @@
 #include "Object.h"
 
-Object::Object(Material& c)
+bool Object::occludes(Ray4& ray, float tmin, float tmax)
 {
-    color = c;
+    Hit hit;
+    return intersects(ray, hit) && hit.t >= tmin && hit.t < tmax;
+}
+
+void Object::intersectsPacket(RayPacket& packet, int first)
+{
+    Hit hit;
+    for (int i = first; i < packet.size; i++) {
+        Ray4 ray = packet.ray(i);
+        if (intersects(ray, hit) && hit.t < packet.tmax[i]) {
+            *packet.hit[i] = hit;
+            packet.tmax[i] = hit.t;
+            packet.status[i] = PACKET_HIT;
+            packet.object[i] = this;
+        }
+    }
+}
+
+void Object::splitBounds(const BBox& clip, int axis, float pos,
+                         BBox& left, BBox& right)
+{
+    left = clip;
+    right = clip;
+    if (left.hi[axis] > pos)
+        left.hi[axis] = pos;
+    if (right.lo[axis] < pos)
+        right.lo[axis] = pos;
+    if (left.lo[axis] > left.hi[axis])
+        left = BBox();
+    if (right.lo[axis] > right.hi[axis])
+        right = BBox();
 }
@@ -5,18 +5,65 @@
 #include "Material.h"
 #include "Hit.h"
 #include "GeomLib.h"
+#include "BBox.h"
+#include "RayPacket.h"
 
-enum ObjectType {NO_OBJECT, SPHERE, TRIANGLE};
+enum ObjectType {NO_OBJECT, SPHERE, TRIANGLE, INSTANCE};
 
+//
+// Something rays can hit.  Materials are kept by the kinds of object
+// that have one (a triangle's in its TrianglePool), as indices into
+// the scene's material list.
+//
+// This is how scenes are put together.  The hierarchies and the brute
+// force backend don't trace rays through these virtual calls: they
+// compile their objects into a PrimitiveList, which tests spheres and
+// triangles from their own arrays and keeps the calls for the rest.
+//
 class Object {
 public:
-    Object(Material& newColor);
+    // Which kind of object this is, for PrimitiveList
+    virtual ObjectType getType() const {return NO_OBJECT;};
+
+    //
+    // Does "ray" hit the object (with t > 0)?  If so, "hit" gets the
+    // closest hit's t, object, part and barycentrics: no more, so that
+    // a traversal pays little for the candidates it goes on to beat.
+    //
     virtual bool intersects(Ray4& ray, Hit& hit) = 0;
-    Material& getColor() {return color;};
 
- protected:
-    Material color;
+    //
+    // The surface at "hit", which intersects() found along "ray":
+    // point, normal and material, made once for the closest hit
+    //
+    virtual void getSurface(Ray4& ray, const Hit& hit,
+                            Surface& surface) = 0;
+
+    //
+    // true iff "ray" hits the object with tmin <= t < tmax: a shadow
+    // ray's test, with no hit record.  The default goes through
+    // intersects(); objects override it to skip the rest of the record.
+    //
+    virtual bool occludes(Ray4& ray, float tmin, float tmax);
+
+    //
+    // intersects() for rays first .. packet.size-1 of "packet": each
+    // ray the object hits closer than its tmax takes the hit.  The
+    // default tests them one at a time and makes the records; objects
+    // override it with a loop over the packet that only notes the hit
+    // (PACKET_PENDING).
+    //
+    virtual void intersectsPacket(RayPacket& packet, int first);
+
+    virtual BBox bounds() = 0;  // box enclosing the whole object
 
+    //
+    // Boxes around the part of the object inside "clip" that lies
+    // below (left) and above (right) the plane x[axis] = pos.  Used by
+    // the spatial-split BVH builder; the default just cuts "clip".
+    //
+    virtual void splitBounds(const BBox& clip, int axis, float pos,
+                             BBox& left, BBox& right);
 };
 
 #endif
@@ -0,0 +1,41 @@
+#include "Parallel.h"
+
+#include <thread>
+#include <vector>
+
+// Ranges shorter than this are not worth starting threads for.
+static const int MIN_PARALLEL_RANGE = 4096;
+
+int workerCount()
+{
+    static int count = 0;
+    if (count == 0) {
+        count = (int)thread::hardware_concurrency();
+        if (count < 1)
+            count = 1;
+    }
+    return count;
+}
+
+void parallelFor(int n, const function<void(int, int, int)>& body)
+{
+    int chunks = workerCount();
+
+    if (chunks == 1 || n < MIN_PARALLEL_RANGE) {
+        // Still report every chunk, so callers can rely on
+        // per-chunk scratch data being filled in.
+        for (int c = 0; c < chunks; c++)
+            body(c, (int)((long long)n * c / chunks),
+                    (int)((long long)n * (c + 1) / chunks));
+        return;
+    }
+
+    vector<thread> workers;
+    for (int c = 1; c < chunks; c++)
+        workers.push_back(thread(body, c, (int)((long long)n * c / chunks),
+                                          (int)((long long)n * (c + 1) / chunks)));
+    body(0, 0, (int)((long long)n / chunks));
+
+    for (int c = 0; c < (int)workers.size(); c++)
+        workers[c].join();
+}
@@ -0,0 +1,22 @@
+#if !defined(_PARALLEL_H_)
+
+#define _PARALLEL_H_
+
+#include <functional>
+
+using namespace std;
+
+//
+// Number of threads the parallel loops use: one per hardware
+// thread, and at least one.
+//
+int workerCount();
+
+//
+// Split [0, n) into workerCount() contiguous chunks, and call
+// body(chunk, begin, end) for each chunk on its own thread.
+// Returns when every chunk is done.  Small ranges run inline.
+//
+void parallelFor(int n, const function<void(int, int, int)>& body);
+
+#endif
@@ -0,0 +1,80 @@
+#include "PerfCounter.h"
+
+#if defined(__linux__)
+
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+PerfCounter::PerfCounter(Event event)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    if (event == CACHE_MISSES) {
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    }
+    else {
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = PERF_COUNT_HW_CACHE_L1D |
+                      (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                      (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    }
+
+    // This thread, any CPU, no group
+    fd = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+PerfCounter::~PerfCounter()
+{
+    if (fd >= 0)
+        close(fd);
+}
+
+void PerfCounter::start()
+{
+    if (fd < 0)
+        return;
+    ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+}
+
+long long PerfCounter::stop()
+{
+    if (fd < 0)
+        return 0;
+    ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    long long count = 0;
+    if (read(fd, &count, sizeof(count)) != sizeof(count))
+        return 0;
+    return count;
+}
+
+#else
+
+PerfCounter::PerfCounter(Event)
+{
+    fd = -1;
+}
+
+PerfCounter::~PerfCounter()
+{
+}
+
+void PerfCounter::start()
+{
+}
+
+long long PerfCounter::stop()
+{
+    return 0;
+}
+
+#endif
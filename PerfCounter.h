@@ -0,0 +1,36 @@
+#if !defined(_PERF_COUNTER_H_)
+
+#define _PERF_COUNTER_H_
+
+//
+// A hardware event counter for the calling thread, read through
+// Linux's perf_event_open().  Elsewhere, or where the kernel doesn't
+// allow it (perf_event_paranoid, containers), isAvailable() is false
+// and stop() returns 0.
+//
+class PerfCounter {
+public:
+    enum Event {
+        CACHE_MISSES,       // last-level cache misses
+        L1D_READ_MISSES     // level-1 data cache read misses
+    };
+
+    PerfCounter(Event event);
+    ~PerfCounter();
+
+    bool isAvailable() const {return fd >= 0;};
+
+    // Zero the count and start counting
+    void start();
+
+    // Stop counting, and return the count since start()
+    long long stop();
+
+private:
+    PerfCounter(const PerfCounter&);
+    PerfCounter& operator=(const PerfCounter&);
+
+    int fd;
+};
+
+#endif
@@ -0,0 +1,176 @@
+#include "PrimitiveList.h"
+
+#include <algorithm>
+
+#include "Sphere.h"
+#include "Triangle.h"
+
+// A slot's kind sits above its index
+static const int PRIM_KIND_SHIFT = 30;
+static const unsigned PRIM_INDEX_MASK = (1u << PRIM_KIND_SHIFT) - 1;
+
+static inline int kindOf(unsigned ref)
+{
+    return (int)(ref >> PRIM_KIND_SHIFT);
+}
+
+static inline int indexOf(unsigned ref)
+{
+    return (int)(ref & PRIM_INDEX_MASK);
+}
+
+static inline int kindRank(const Object *object)
+{
+    ObjectType type = object->getType();
+    return (type == SPHERE) ? PRIM_SPHERE :
+           (type == TRIANGLE) ? PRIM_TRIANGLE : PRIM_OBJECT;
+}
+
+struct KindLess {
+    bool operator()(const Object *a, const Object *b) const {
+        return kindRank(a) < kindRank(b);
+    }
+};
+
+void PrimitiveList::groupByType(Object **objects, int n)
+{
+    stable_sort(objects, objects + n, KindLess());
+}
+
+/////////////////////////////////////////////////////////////////////////
+// Triangles of a pool other than the first one met are compiled as
+// objects; rt keeps every triangle in one pool.
+/////////////////////////////////////////////////////////////////////////
+void PrimitiveList::compile(Object * const *objects, int n)
+{
+    vector<Sphere*> sphereList;
+    refs.resize(n);
+    triangles.clear();
+    pool = NULL;
+
+    for (int i = 0; i < n; i++) {
+        ObjectType type = objects[i]->getType();
+        if (type == SPHERE) {
+            refs[i] = (PRIM_SPHERE << PRIM_KIND_SHIFT) |
+                      (unsigned)sphereList.size();
+            sphereList.push_back(static_cast<Sphere*>(objects[i]));
+            continue;
+        }
+        if (type == TRIANGLE) {
+            Triangle *t = static_cast<Triangle*>(objects[i]);
+            if (pool == NULL)
+                pool = t->getPool();
+            if (t->getPool() == pool) {
+                refs[i] = (PRIM_TRIANGLE << PRIM_KIND_SHIFT) |
+                          (unsigned)triangles.size();
+                triangles.push_back(t->getIndex());
+                continue;
+            }
+        }
+        refs[i] = (unsigned)PRIM_OBJECT << PRIM_KIND_SHIFT;
+    }
+    spheres.gather(sphereList.empty() ? NULL : &sphereList[0],
+                   (int)sphereList.size());
+}
+
+/////////////////////////////////////////////////////////////////////////
+// Each run of one kind is tested as a whole.  Spheres come before
+// triangles in a grouped list, so on an exact tie the sphere wins.
+/////////////////////////////////////////////////////////////////////////
+bool PrimitiveList::firstHit(Object * const *objects, int first, int count,
+                             Ray4& ray, const SphereRay& r, Hit& scratch,
+                             Hit& hit, float& tmax) const
+{
+    bool found = false;
+    int end = first + count;
+
+    for (int i = first; i < end; ) {
+        int kind = kindOf(refs[i]);
+        int j = i + 1;
+        while (j < end && kindOf(refs[j]) == kind)
+            j++;
+
+        if (kind == PRIM_SPHERE) {
+            float t;
+            int s = spheres.firstHit(indexOf(refs[i]), j - i, r, tmax, t);
+            if (s >= 0) {
+                hit.t = t;
+                hit.object = hit.part = spheres.sphere(s);
+                hit.u = hit.v = 0;
+                tmax = t;
+                found = true;
+            }
+        }
+        else if (kind == PRIM_TRIANGLE) {
+            int k = pool->firstHit(&triangles[indexOf(refs[i])], j - i, ray,
+                                   hit, tmax);
+            if (k >= 0) {
+                hit.object = hit.part = objects[i + k];
+                found = true;
+            }
+        }
+        else {
+            for (int k = i; k < j; k++) {
+                if (objects[k]->intersects(ray, scratch) && scratch.t < tmax) {
+                    hit = scratch;
+                    tmax = scratch.t;
+                    found = true;
+                }
+            }
+        }
+        i = j;
+    }
+    return found;
+}
+
+bool PrimitiveList::occludes(Object * const *objects, int first, int count,
+                             Ray4& ray, const SphereRay& r, float tmin,
+                             float tmax, int& tested) const
+{
+    int end = first + count;
+
+    for (int i = first; i < end; ) {
+        int kind = kindOf(refs[i]);
+        int j = i + 1;
+        while (j < end && kindOf(refs[j]) == kind)
+            j++;
+
+        if (kind == PRIM_SPHERE) {
+            tested += j - i;
+            if (spheres.occludes(indexOf(refs[i]), j - i, r, tmin, tmax))
+                return true;
+        }
+        else if (kind == PRIM_TRIANGLE) {
+            tested += j - i;
+            if (pool->occludes(&triangles[indexOf(refs[i])], j - i, ray,
+                               tmin, tmax))
+                return true;
+        }
+        else {
+            for (int k = i; k < j; k++) {
+                tested++;
+                if (objects[k]->occludes(ray, tmin, tmax))
+                    return true;
+            }
+        }
+        i = j;
+    }
+    return false;
+}
+
+void PrimitiveList::intersectsPacket(Object * const *objects, int first,
+                                     int count, RayPacket& packet,
+                                     int firstRay) const
+{
+    for (int i = first; i < first + count; i++) {
+        int kind = kindOf(refs[i]);
+        if (kind == PRIM_SPHERE)
+            spheres.sphere(indexOf(refs[i]))->Sphere::intersectsPacket(
+                packet, firstRay);
+        else if (kind == PRIM_TRIANGLE)
+            pool->intersects(triangles[indexOf(refs[i])], packet, firstRay,
+                             objects[i]);
+        else
+            objects[i]->intersectsPacket(packet, firstRay);
+    }
+}
@@ -0,0 +1,91 @@
+#if !defined(_PRIMITIVE_LIST_H_)
+
+#define _PRIMITIVE_LIST_H_
+
+#include <vector>
+
+#include "GeomLib.h"
+#include "Hit.h"
+#include "Object.h"
+#include "RayPacket.h"
+#include "SphereArray.h"
+#include "TrianglePool.h"
+
+//
+// The kinds of primitive a PrimitiveList tells apart, in the order
+// groupByType() puts them in
+//
+enum PrimKind {PRIM_SPHERE, PRIM_TRIANGLE, PRIM_OBJECT};
+
+//
+// A list of objects (a hierarchy's leaf references, or all the objects
+// for brute force) compiled for tracing.  Each slot of the list gets a
+// tagged index: the kind of primitive, and where its data is kept.
+// Spheres go into a SphereArray and triangles are referred to by their
+// index in their TrianglePool.  Everything else (instances) keeps its
+// Object.  A run of slots of one kind is then tested in one loop,
+// without a virtual call per primitive: spheres by the vector kernels,
+// triangles by TrianglePool's loops.
+//
+// Runs are longest when the list is grouped by kind (see
+// groupByType()).
+//
+class PrimitiveList {
+public:
+    PrimitiveList() : pool(NULL) {}
+
+    //
+    // Compile objects[0] .. objects[n-1], slot for slot.  Call again
+    // after any of them has moved.
+    //
+    void compile(Object * const *objects, int n);
+
+    //
+    // Reorder objects[0] .. objects[n-1] into spheres, then triangles,
+    // then the rest, each kind in the order it had
+    //
+    static void groupByType(Object **objects, int n);
+
+    //
+    // The closest hit among slots first .. first+count-1 with t < tmax:
+    // fills in "hit", lowers tmax and returns true if there is one.
+    // "objects" is the list compiled; "scratch" is the caller's spare
+    // record for the objects tested through their own intersects().
+    //
+    bool firstHit(Object * const *objects, int first, int count,
+                  Ray4& ray, const SphereRay& r, Hit& scratch, Hit& hit,
+                  float& tmax) const;
+
+    //
+    // true iff one of those slots occludes [tmin, tmax); "tested"
+    // grows by the primitives tested, as the traversals count them
+    //
+    bool occludes(Object * const *objects, int first, int count,
+                  Ray4& ray, const SphereRay& r, float tmin, float tmax,
+                  int& tested) const;
+
+    //
+    // Object::intersectsPacket() of each of those slots, for rays
+    // firstRay on: a non-virtual call for spheres and triangles
+    //
+    void intersectsPacket(Object * const *objects, int first, int count,
+                          RayPacket& packet, int firstRay) const;
+
+    int sphereCount() const {return spheres.size();};
+    int triangleCount() const {return (int)triangles.size();};
+
+    // Bytes held
+    size_t memoryBytes() const {
+        return refs.capacity() * sizeof(unsigned) + spheres.memoryBytes() +
+               triangles.capacity() * sizeof(int);
+    };
+
+private:
+    vector<unsigned> refs;      // per slot: PrimKind << PRIM_KIND_SHIFT,
+                                // and the index in spheres or triangles
+    SphereArray spheres;
+    vector<int> triangles;      // indices into *pool
+    TrianglePool *pool;         // that of every triangle compiled as one
+};
+
+#endif
@@ -0,0 +1,43 @@
+#include "RayPacket.h"
+
+#include "Object.h"
+
+void RayPacket::add(const Ray4& ray, float t, Hit *record)
+{
+    int i = size++;
+    ox[i] = ray.start[0];
+    oy[i] = ray.start[1];
+    oz[i] = ray.start[2];
+    dx[i] = ray.direction[0];
+    dy[i] = ray.direction[1];
+    dz[i] = ray.direction[2];
+    ix[i] = 1.0f / dx[i];
+    iy[i] = 1.0f / dy[i];
+    iz[i] = 1.0f / dz[i];
+    tmax[i] = t;
+    status[i] = PACKET_MISS;
+    object[i] = NULL;
+    hit[i] = record;
+}
+
+Ray4 RayPacket::ray(int i) const
+{
+    Point4 s(ox[i], oy[i], oz[i]);
+    Vector4 d(dx[i], dy[i], dz[i]);
+    return Ray4(s, d);
+}
+
+//
+// The packet tests compute t exactly as intersects() does, so the
+// object a pending ray noted is hit again here, at the same t.
+//
+void RayPacket::record()
+{
+    for (int i = 0; i < size; i++) {
+        if (status[i] != PACKET_PENDING)
+            continue;
+        Ray4 r = ray(i);
+        status[i] = object[i]->intersects(r, *hit[i]) ? PACKET_HIT
+                                                      : PACKET_MISS;
+    }
+}
@@ -0,0 +1,66 @@
+#if !defined(_RAY_PACKET_H_)
+
+#define _RAY_PACKET_H_
+
+#include "GeomLib.h"
+#include "Hit.h"
+
+class Object;
+
+// The most rays a packet holds: 16 x 16 pixels
+const int PACKET_MAX_RAYS = 256;
+
+//
+// What a ray of a packet has found so far:
+//   PACKET_MISS     nothing
+//   PACKET_HIT      its hit record is made
+//   PACKET_PENDING  object[i] is hit at tmax[i], and the record is
+//                   still to be made (see RayPacket::record())
+//
+enum PacketStatus {PACKET_MISS, PACKET_HIT, PACKET_PENDING};
+
+//
+// Rays traced together (see Accelerator::firstHits()), stored
+// component by component so that a primitive can be tested against
+// all of them in one vectorized loop.  Each ray keeps its closest hit
+// so far: its distance in tmax[i], and its record in *hit[i].  The
+// packet tests of triangles and spheres only note which object was
+// hit; record() then makes one record per ray, for the closest hit.
+//
+struct RayPacket {
+    int size;                               // rays in use
+
+    alignas(32) float ox[PACKET_MAX_RAYS];  // starts
+    alignas(32) float oy[PACKET_MAX_RAYS];
+    alignas(32) float oz[PACKET_MAX_RAYS];
+    alignas(32) float dx[PACKET_MAX_RAYS];  // directions
+    alignas(32) float dy[PACKET_MAX_RAYS];
+    alignas(32) float dz[PACKET_MAX_RAYS];
+    alignas(32) float ix[PACKET_MAX_RAYS];  // 1 / direction
+    alignas(32) float iy[PACKET_MAX_RAYS];
+    alignas(32) float iz[PACKET_MAX_RAYS];
+    alignas(32) float tmax[PACKET_MAX_RAYS];
+    alignas(32) int status[PACKET_MAX_RAYS];
+    Object *object[PACKET_MAX_RAYS];
+    Hit *hit[PACKET_MAX_RAYS];
+
+    RayPacket() : size(0) {}
+
+    void clear() {size = 0;};
+
+    //
+    // Add a ray that looks for hits with t < tmax; the closest one's
+    // record goes in *record
+    //
+    void add(const Ray4& ray, float tmax, Hit *record);
+
+    // Ray i as a Ray4
+    Ray4 ray(int i) const;
+
+    //
+    // Make the hit records of the PACKET_PENDING rays
+    //
+    void record();
+};
+
+#endif
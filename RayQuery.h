@@ -0,0 +1,91 @@
+#if !defined(_RAY_QUERY_H_)
+
+#define _RAY_QUERY_H_
+
+#include "GeomLib.h"
+#include "Hit.h"
+#include "Object.h"
+#include "PrimitiveList.h"
+#include "SphereArray.h"
+
+//
+// What a traversal is asked for.  The traversal loops (BVH.cpp,
+// BVH8Kernel.h, Grid.cpp) take the query as a template parameter, so
+// each kind of ray gets a loop of its own, with the other kinds'
+// branches compiled out.  For a query type Query:
+//
+//   Query::anyHit       true: stop at the first hit found.  tmax
+//                       stays fixed, so nothing is culled against it
+//                       after the box tests.  false: go on to the
+//                       closest hit, lowering tmax to each one found.
+//   queryLeaf(query, ...)    test a leaf's slots of a PrimitiveList
+//   queryObject(query, ...)  test one object (for the grid)
+//
+// Both tests return true if they find a hit.
+//
+// ClosestHitQuery is for camera rays, and for reflection rays once
+// there are any.  AnyHitQuery is for shadow rays.  Both count hits on
+// either side of a surface, which is what the shading expects.
+//
+// The tests are static, like everything in BVH8Kernel.h, so that a
+// file compiled for a wider instruction set keeps its own copies.
+//
+
+//
+// The closest hit with 0 < t < tmax, into "hit"
+//
+struct ClosestHitQuery {
+    static const bool anyHit = false;
+
+    Hit& hit;
+    Hit scratch;        // PrimitiveList's spare record
+
+    ClosestHitQuery(Hit& h) : hit(h) {}
+};
+
+//
+// Whether anything is hit with tmin <= t < tmax, with no hit record
+//
+struct AnyHitQuery {
+    static const bool anyHit = true;
+
+    float tmin;
+
+    AnyHitQuery(float t) : tmin(t) {}
+};
+
+static inline bool queryLeaf(ClosestHitQuery& q, const PrimitiveList& list,
+                             Object * const *prims, int first, int count,
+                             Ray4& ray, const SphereRay& r, float& tmax,
+                             int& tested)
+{
+    tested += count;
+    return list.firstHit(prims, first, count, ray, r, q.scratch, q.hit,
+                         tmax);
+}
+
+static inline bool queryLeaf(AnyHitQuery& q, const PrimitiveList& list,
+                             Object * const *prims, int first, int count,
+                             Ray4& ray, const SphereRay& r, float& tmax,
+                             int& tested)
+{
+    return list.occludes(prims, first, count, ray, r, q.tmin, tmax, tested);
+}
+
+static inline bool queryObject(ClosestHitQuery& q, Object *o, Ray4& ray,
+                               float& tmax)
+{
+    if (!o->intersects(ray, q.scratch) || !(q.scratch.t < tmax))
+        return false;
+    q.hit = q.scratch;
+    tmax = q.scratch.t;
+    return true;
+}
+
+static inline bool queryObject(AnyHitQuery& q, Object *o, Ray4& ray,
+                               float& tmax)
+{
+    return o->occludes(ray, q.tmin, tmax);
+}
+
+#endif
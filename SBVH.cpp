@@ -0,0 +1,327 @@
+//
+// Spatial-split BVH builder (Stich, Friedrich and Dietrich, "Spatial
+// Splits in Bounding Volume Hierarchies", HPG 2009).
+//
+// An object split sends every primitive to one side, so large or long
+// primitives make the two children overlap and rays have to visit
+// both.  A spatial split instead cuts the node's box with a plane and
+// clips the primitives that straddle it, so that each side gets a
+// reference with a tighter box.  This trades more leaf references
+// (bounded by the duplication budget) for fewer node visits per ray.
+//
+
+#include "BVH.h"
+
+#include <algorithm>
+#include <cfloat>
+
+// Relative costs of one traversal step and one primitive test,
+// as in BVH.cpp
+static const float TRAVERSAL_COST = 1.0f;
+static const float INTERSECT_COST = 1.0f;
+
+static const int MAX_LEAF_SIZE = 8;
+static const int MEDIAN_SPLIT_DEPTH = 40;
+
+// Candidate planes per axis for both kinds of split
+static const int BIN_COUNT = 32;
+
+// Spatial splits are only tried where the children of the best object
+// split overlap by more than this fraction of the root's surface area.
+static const float SPLIT_ALPHA = 1e-5f;
+
+//
+// The best spatial split found for a node: the plane x[axis] = pos
+//
+struct SpatialSplit {
+    float cost;         // count * area of both sides, summed
+    int axis;           // -1: none
+    float pos;
+};
+
+/////////////////////////////////////////////////////////////////////////
+// Cut the node's box into BIN_COUNT equal slices per axis, chop each
+// reference into the slices it spans, and evaluate the SAH at the
+// planes between slices.  A reference counts on the left of every
+// plane after the slice it starts in, and on the right of every plane
+// before the slice it ends in.
+/////////////////////////////////////////////////////////////////////////
+static SpatialSplit findSpatialSplit(const vector<BVHBuildRef>& refs,
+                                     const BBox& box,
+                                     Object * const *objects)
+{
+    SpatialSplit best;
+    best.cost = FLT_MAX;
+    best.axis = -1;
+    best.pos = 0;
+
+    for (int a = 0; a < 3; a++) {
+        float extent = box.hi[a] - box.lo[a];
+        if (extent <= 0)
+            continue;
+
+        float width = extent / BIN_COUNT;
+        float scale = BIN_COUNT / extent;
+        BBox binBox[BIN_COUNT];
+        int enter[BIN_COUNT] = {0};
+        int leave[BIN_COUNT] = {0};
+
+        for (int i = 0; i < (int)refs.size(); i++) {
+            const BVHBuildRef& ref = refs[i];
+            int first = (int)((ref.box.lo[a] - box.lo[a]) * scale);
+            int last  = (int)((ref.box.hi[a] - box.lo[a]) * scale);
+            first = max(0, min(first, BIN_COUNT - 1));
+            last  = max(first, min(last, BIN_COUNT - 1));
+
+            BBox rest = ref.box;
+            for (int b = first; b < last; b++) {
+                BBox left, right;
+                objects[ref.index]->splitBounds(rest, a, box.lo[a] + (b + 1) * width,
+                                                left, right);
+                binBox[b].grow(left);
+                rest = right;
+            }
+            binBox[last].grow(rest);
+            enter[first]++;
+            leave[last]++;
+        }
+
+        // The plane "b" lies between slices b-1 and b
+        BBox rightBox[BIN_COUNT];
+        int rightCount[BIN_COUNT];
+        BBox right;
+        int count = 0;
+        for (int b = BIN_COUNT - 1; b > 0; b--) {
+            right.grow(binBox[b]);
+            count += leave[b];
+            rightBox[b] = right;
+            rightCount[b] = count;
+        }
+
+        BBox left;
+        count = 0;
+        for (int b = 1; b < BIN_COUNT; b++) {
+            left.grow(binBox[b-1]);
+            count += enter[b-1];
+            if (count == 0 || rightCount[b] == 0)
+                continue;
+            float cost = count * left.surfaceArea()
+                       + rightCount[b] * rightBox[b].surfaceArea();
+            if (cost < best.cost) {
+                best.cost = cost;
+                best.axis = a;
+                best.pos = box.lo[a] + b * width;
+            }
+        }
+    }
+
+    return best;
+}
+
+// Reset the centroid of a reference whose box has changed
+static inline void setCentroid(BVHBuildRef& ref)
+{
+    for (int a = 0; a < 3; a++)
+        ref.c[a] = ref.box.center(a);
+}
+
+/////////////////////////////////////////////////////////////////////////
+// Distribute "refs" over the two sides of a spatial split.  References
+// that straddle the plane are clipped into both sides, unless putting
+// the whole reference on one side is cheaper by the SAH, or the budget
+// is used up ("reference unsplitting").  Returns the number of extra
+// references made.
+/////////////////////////////////////////////////////////////////////////
+static int partitionSpatial(const vector<BVHBuildRef>& refs,
+                            const SpatialSplit& split, int budget,
+                            Object * const *objects,
+                            vector<BVHBuildRef>& leftRefs,
+                            vector<BVHBuildRef>& rightRefs)
+{
+    int axis = split.axis;
+    float pos = split.pos;
+    BBox leftBox, rightBox;
+    vector<int> straddling;
+
+    for (int i = 0; i < (int)refs.size(); i++) {
+        const BVHBuildRef& ref = refs[i];
+        if (ref.box.hi[axis] <= pos) {
+            leftRefs.push_back(ref);
+            leftBox.grow(ref.box);
+        }
+        else if (ref.box.lo[axis] >= pos) {
+            rightRefs.push_back(ref);
+            rightBox.grow(ref.box);
+        }
+        else
+            straddling.push_back(i);
+    }
+
+    int added = 0;
+    for (int k = 0; k < (int)straddling.size(); k++) {
+        const BVHBuildRef& ref = refs[straddling[k]];
+        BVHBuildRef l = ref;
+        BVHBuildRef r = ref;
+        objects[ref.index]->splitBounds(ref.box, axis, pos, l.box, r.box);
+
+        // Clipping can find nothing on one side (a vertex just
+        // touching the plane, say): no need to split then.
+        if (l.box.isEmpty()) {
+            rightRefs.push_back(ref);
+            rightBox.grow(ref.box);
+            continue;
+        }
+        if (r.box.isEmpty()) {
+            leftRefs.push_back(ref);
+            leftBox.grow(ref.box);
+            continue;
+        }
+
+        int nl = (int)leftRefs.size();
+        int nr = (int)rightRefs.size();
+        BBox splitL = leftBox;  splitL.grow(l.box);
+        BBox splitR = rightBox; splitR.grow(r.box);
+        BBox allL = leftBox;    allL.grow(ref.box);
+        BBox allR = rightBox;   allR.grow(ref.box);
+
+        float costSplit = (added < budget)
+            ? splitL.surfaceArea() * (nl + 1) + splitR.surfaceArea() * (nr + 1)
+            : FLT_MAX;
+        float costLeft  = allL.surfaceArea() * (nl + 1) + rightBox.surfaceArea() * nr;
+        float costRight = leftBox.surfaceArea() * nl + allR.surfaceArea() * (nr + 1);
+
+        if (costSplit < costLeft && costSplit < costRight) {
+            setCentroid(l);
+            setCentroid(r);
+            leftRefs.push_back(l);
+            rightRefs.push_back(r);
+            leftBox = splitL;
+            rightBox = splitR;
+            added++;
+        }
+        else if (costLeft <= costRight) {
+            leftRefs.push_back(ref);
+            leftBox = allL;
+        }
+        else {
+            rightRefs.push_back(ref);
+            rightBox = allR;
+        }
+    }
+
+    return added;
+}
+
+/////////////////////////////////////////////////////////////////////////
+// Build the subtree at nodes[nodeIndex] over "refs" (which it empties),
+// choosing at every node between a leaf, the best binned object split
+// and the best spatial split.  Leaf references are appended to
+// state.refs.
+/////////////////////////////////////////////////////////////////////////
+void BVH::buildSpatial(BVHBuildState& state, vector<BVHBuildRef>& refs,
+                       int nodeIndex, int depth)
+{
+    int n = (int)refs.size();
+
+    BBox box;
+    float clo[3] = { FLT_MAX,  FLT_MAX,  FLT_MAX};
+    float chi[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+    for (int i = 0; i < n; i++) {
+        box.grow(refs[i].box);
+        for (int a = 0; a < 3; a++) {
+            float c = refs[i].c[a];
+            clo[a] = (c < clo[a]) ? c : clo[a];
+            chi[a] = (c > chi[a]) ? c : chi[a];
+        }
+    }
+    nodes[nodeIndex].box = box;
+
+    if (depth == 0)
+        state.minOverlap = SPLIT_ALPHA * box.surfaceArea();
+
+    BVHBinning binning;
+    binning.bins = min(BIN_COUNT, 2 * n);
+    for (int a = 0; a < 3; a++) {
+        float extent = chi[a] - clo[a];
+        binning.lo[a] = clo[a];
+        binning.scale[a] = (extent > 0) ? binning.bins * 0.99999f / extent : 0;
+    }
+    binning.axis = -1;
+
+    SpatialSplit spatial;
+    spatial.axis = -1;
+    bool leaf = (n == 1);
+
+    if (!leaf && depth < MEDIAN_SPLIT_DEPTH) {
+        findObjectSplit(&refs[0], n, binning);
+
+        // Only look for a spatial split if the object split's
+        // children overlap noticeably
+        BBox overlap = binning.left;
+        overlap.clip(binning.right);
+        if (state.splitBudget > 0 &&
+            (binning.axis < 0 || overlap.surfaceArea() > state.minOverlap))
+            spatial = findSpatialSplit(refs, box, state.objects);
+
+        float area = box.surfaceArea();
+        float leafCost = INTERSECT_COST * n;
+        float bestCost = FLT_MAX;
+        if (binning.axis >= 0)
+            bestCost = binning.cost;
+        if (spatial.axis >= 0 && spatial.cost < bestCost)
+            bestCost = spatial.cost;
+        else
+            spatial.axis = -1;
+        float splitCost = (bestCost < FLT_MAX && area > 0)
+            ? TRAVERSAL_COST + INTERSECT_COST * bestCost / area
+            : leafCost;
+
+        leaf = (n <= MAX_LEAF_SIZE && splitCost >= leafCost);
+    }
+
+    if (leaf) {
+        int begin = (int)state.refs.size();
+        state.refs.insert(state.refs.end(), refs.begin(), refs.end());
+        makeLeaf(nodeIndex, begin, begin + n);
+        vector<BVHBuildRef>().swap(refs);
+        return;
+    }
+
+    vector<BVHBuildRef> leftRefs, rightRefs;
+
+    if (spatial.axis >= 0) {
+        int added = partitionSpatial(refs, spatial, state.splitBudget,
+                                     state.objects, leftRefs, rightRefs);
+        if (leftRefs.empty() || rightRefs.empty()) {
+            // Unsplitting moved everything to one side
+            leftRefs.clear();
+            rightRefs.clear();
+        }
+        else
+            state.splitBudget -= added;
+    }
+
+    if (leftRefs.empty()) {
+        int mid;
+        if (binning.axis >= 0)
+            mid = partitionObjects(&refs[0], n, binning);
+        else {
+            // Too deep, or all centroids coincide: split at the median
+            mid = n/2;
+            int axis = box.maxExtent();
+            nth_element(refs.begin(), refs.begin() + mid, refs.end(),
+                        [=](const BVHBuildRef& a, const BVHBuildRef& b) {
+                            return a.c[axis] < b.c[axis];
+                        });
+        }
+        leftRefs.assign(refs.begin(), refs.begin() + mid);
+        rightRefs.assign(refs.begin() + mid, refs.end());
+    }
+    vector<BVHBuildRef>().swap(refs);
+
+    makeInner(state, nodeIndex);
+    int children = nodes[nodeIndex].first;
+
+    buildSpatial(state, leftRefs,  children,     depth + 1);
+    buildSpatial(state, rightRefs, children + 1, depth + 1);
+}
@@ -1,11 +1,10 @@
 #include "Sphere.h"
 
-Sphere::Sphere(Point4& center, float radius, Material& color)
-    : Object(color) {
+Sphere::Sphere(Point4& center, float radius, int material) {
 
 	this -> c = center;
 	this -> r = radius;
-	this -> m = color;
+	this -> m = material;
 
 	
 
@@ -18,9 +17,6 @@ bool Sphere::intersects(Ray4& ray, Hit& hit) {
 
 	Vector4 V = ray.direction;
 
-	Point4 P_sphere;
-	Vector4 N_sphere;
-
 	float a = V * V;
 	float b = ( (2*V) * (P_s - c));
 	float _c = (P_s - c) * (P_s - c)  - (r*r) ;
@@ -54,14 +50,11 @@ bool Sphere::intersects(Ray4& ray, Hit& hit) {
             return false;
         }
 
-       	P_sphere = P_s + t*V;
-
-        N_sphere = (P_sphere - c).normalized();
-
-        hit.hit_point = ray.at(t);
-        hit.normal = N_sphere;
-        hit.material = m;
         hit.t = t;
+        hit.object = this;
+        hit.part = this;
+        hit.u = 0;
+        hit.v = 0;
 
 
 
@@ -73,3 +66,86 @@ bool Sphere::intersects(Ray4& ray, Hit& hit) {
     
 }
 
+//
+// The root intersects() would report (the nearer one, if it is in
+// front of the ray), without the hit record
+//
+bool Sphere::occludes(Ray4& ray, float tmin, float tmax) {
+    Vector4 V = ray.direction;
+    Vector4 D = ray.start - c;
+
+    float a = V * V;
+    float b = (2*V) * D;
+    float _c = D * D - (r*r);
+    float d = (b*b) - (4 * a * _c);
+    if (d < 0)
+        return false;
+
+    float t_1 = (-b + sqrt(d))/(2*a);
+    float t_2 = (-b - sqrt(d))/(2*a);
+    float t = (t_1 < t_2) ? t_1 : t_2;
+    return t > 0 && t >= tmin && t < tmax;
+}
+
+//
+// intersects() across a packet, in a loop the compiler vectorizes.
+// The dot products add up in double precision and the roots are
+// chosen as intersects() chooses them, so each ray gets the t that
+// intersects() will give it when its hit record is made.
+//
+void Sphere::intersectsPacket(RayPacket& packet, int first) {
+    const float cx = c[0], cy = c[1], cz = c[2];
+    const float rr = r*r;
+    int hit[PACKET_MAX_RAYS];
+    int hits = 0;
+
+    for (int k = first; k < packet.size; k++) {
+        float vx = packet.dx[k], vy = packet.dy[k], vz = packet.dz[k];
+        float sx = packet.ox[k] - cx;
+        float sy = packet.oy[k] - cy;
+        float sz = packet.oz[k] - cz;
+
+        float a = (double)(vx*vx) + (double)(vy*vy) + (double)(vz*vz);
+        float b = (double)((2*vx)*sx) + (double)((2*vy)*sy) +
+                  (double)((2*vz)*sz);
+        float _c = (float)((double)(sx*sx) + (double)(sy*sy) +
+                           (double)(sz*sz)) - rr;
+        float d = (b*b) - (4 * a * _c);
+
+        // Square root of 0 for a miss (d < 0), so that it sets no errno
+        // and doesn't stop the loop being vectorized
+        float root = sqrtf(d >= 0 ? d : 0);
+        float t_1 = (-b + root)/(2*a);
+        float t_2 = (-b - root)/(2*a);
+        int near1 = (t_1 < t_2) & (t_1 > 0);
+        int near2 = (t_2 <= t_1) & (t_2 > 0);
+        float t = near1 ? t_1 : t_2;
+
+        int h = (d >= 0) & (near1 | near2) & (t < packet.tmax[k]);
+        packet.tmax[k] = h ? t : packet.tmax[k];
+        packet.status[k] = h ? (int)PACKET_PENDING : packet.status[k];
+        hit[k] = h;
+        hits |= h;
+    }
+
+    if (hits == 0)
+        return;
+    for (int k = first; k < packet.size; k++)
+        if (hit[k])
+            packet.object[k] = this;
+}
+
+void Sphere::getSurface(Ray4& ray, const Hit& hit, Surface& surface) {
+    surface.hit_point = ray.at(hit.t);
+    surface.normal = (surface.hit_point - c).normalized();
+    surface.material = m;
+}
+
+BBox Sphere::bounds() {
+    Vector4 extent(r, r, r);
+    return BBox(c - extent, c + extent);
+}
+
+void Sphere::setCenter(Point4& center) {
+    this -> c = center;
+}
@@ -7,15 +7,27 @@
 #include "Material.h"
 #include "Hit.h"
 
-class Sphere : public virtual Object {
+class Sphere : public Object {
 public:
-    Sphere(Point4& center, float radius, Material& color);
+    Sphere(Point4& center, float radius, int material);
+    ObjectType getType() const {return SPHERE;};
     bool intersects(Ray4& ray, Hit& hit);
+    bool occludes(Ray4& ray, float tmin, float tmax);
+    void intersectsPacket(RayPacket& packet, int first);
+    void getSurface(Ray4& ray, const Hit& hit, Surface& surface);
+
+    BBox bounds();
+
+    // Moving a sphere: call BVH::update() afterwards
+    Point4& getCenter() {return c;};
+    float getRadius() const {return r;};
+    int getMaterial() const {return m;};
+    void setCenter(Point4& center);
 
 private:
     Point4 c;
     float r;
-    Material m;
+    int m;              // index into the scene's material list
 };
 
 #endif
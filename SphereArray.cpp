@@ -0,0 +1,162 @@
+#include "SphereArray.h"
+
+#include <cmath>
+#include <limits>
+
+#include "Isa.h"
+#include "Sphere.h"
+
+// Entries past the last sphere, so that the wide kernels may load a
+// whole vector from any index
+static const int SPHERE_PADDING = 16;
+
+SphereRay::SphereRay(Ray4& ray)
+{
+    Vector4 d = ray.direction;
+    length = sqrtf(d * d);
+    invLength = 1.0f / length;
+    for (int a = 0; a < 3; a++) {
+        org[a] = ray.start[a];
+        dir[a] = d[a] * invLength;
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////
+// With a unit direction u and s = start - center, the ray hits the
+// sphere at t = -b -+ sqrt(b^2 - c), b = u.s and c = s.s - r^2.  Only
+// the nearer root counts, as in Sphere::intersects(): a ray that
+// starts inside a sphere doesn't hit it.
+/////////////////////////////////////////////////////////////////////////
+int sphereFirstHitScalar(const SphereSlots& s, int first, int count,
+                         const SphereRay& r, float tmax, float& t)
+{
+    int best = -1;
+    for (int i = first; i < first + count; i++) {
+        float sx = r.org[0] - s.cx[i];
+        float sy = r.org[1] - s.cy[i];
+        float sz = r.org[2] - s.cz[i];
+        float b = sx * r.dir[0] + sy * r.dir[1] + sz * r.dir[2];
+        float c = (sx * sx + sy * sy + sz * sz) - s.rr[i];
+        float d = b * b - c;
+        if (!(d >= 0))
+            continue;
+
+        float tNear = -b - sqrtf(d);
+        if (tNear > 0 && tNear < tmax) {
+            tmax = tNear;
+            t = tNear;
+            best = i;
+        }
+    }
+    return best;
+}
+
+bool sphereAnyHitScalar(const SphereSlots& s, int first, int count,
+                        const SphereRay& r, float tmin, float tmax)
+{
+    for (int i = first; i < first + count; i++) {
+        float sx = r.org[0] - s.cx[i];
+        float sy = r.org[1] - s.cy[i];
+        float sz = r.org[2] - s.cz[i];
+        float b = sx * r.dir[0] + sy * r.dir[1] + sz * r.dir[2];
+        float c = (sx * sx + sy * sy + sz * sz) - s.rr[i];
+        float d = b * b - c;
+        if (!(d >= 0))
+            continue;
+
+        float tNear = -b - sqrtf(d);
+        if (tNear > 0 && tNear >= tmin && tNear < tmax)
+            return true;
+    }
+    return false;
+}
+
+//
+// The widest kernel built in that activeIsa() allows, chosen once
+//
+struct SphereKernels {
+    SphereHitKernel hit;
+    SphereAnyKernel any;
+    const char *name;
+};
+
+static SphereKernels chooseSphereKernels()
+{
+    SphereKernels k = {sphereFirstHitScalar, sphereAnyHitScalar, "scalar"};
+    IsaLevel isa = activeIsa();
+
+    if (isa >= ISA_AVX512 && sphereAvx512Kernel() != NULL) {
+        k.hit = sphereAvx512Kernel();
+        k.any = sphereAvx512AnyKernel();
+        k.name = isaName(ISA_AVX512);
+    }
+    else if (isa >= ISA_AVX2 && sphereAvx2Kernel() != NULL) {
+        k.hit = sphereAvx2Kernel();
+        k.any = sphereAvx2AnyKernel();
+        k.name = isaName(ISA_AVX2);
+    }
+    else if (isa >= ISA_SSE42 && sphereSse4Kernel() != NULL) {
+        k.hit = sphereSse4Kernel();
+        k.any = sphereSse4AnyKernel();
+        k.name = isaName(ISA_SSE42);
+    }
+    return k;
+}
+
+static const SphereKernels& sphereKernels()
+{
+    static const SphereKernels kernels = chooseSphereKernels();
+    return kernels;
+}
+
+const char *sphereKernelName()
+{
+    return sphereKernels().name;
+}
+
+void SphereArray::gather(Sphere * const *spheres, int n)
+{
+    owners.assign(spheres, spheres + n);
+    if (n == 0) {
+        FloatArray().swap(cx);
+        FloatArray().swap(cy);
+        FloatArray().swap(cz);
+        FloatArray().swap(rr);
+        return;
+    }
+
+    const float none = numeric_limits<float>::quiet_NaN();
+    cx.assign(n + SPHERE_PADDING, none);
+    cy.assign(n + SPHERE_PADDING, none);
+    cz.assign(n + SPHERE_PADDING, none);
+    rr.assign(n + SPHERE_PADDING, 0);
+    for (int i = 0; i < n; i++) {
+        Point4& c = spheres[i]->getCenter();
+        cx[i] = c[0];
+        cy[i] = c[1];
+        cz[i] = c[2];
+        rr[i] = spheres[i]->getRadius() * spheres[i]->getRadius();
+    }
+}
+
+int SphereArray::firstHit(int first, int count, const SphereRay& r,
+                          float tmax, float& t) const
+{
+    SphereSlots s = {&cx[0], &cy[0], &cz[0], &rr[0]};
+    float tUnit;
+    int i = sphereKernels().hit(s, first, count, r, tmax * r.length, tUnit);
+    if (i < 0)
+        return -1;
+
+    // Rounding may take t back up to tmax
+    t = tUnit * r.invLength;
+    return (t < tmax) ? i : -1;
+}
+
+bool SphereArray::occludes(int first, int count, const SphereRay& r,
+                           float tmin, float tmax) const
+{
+    SphereSlots s = {&cx[0], &cy[0], &cz[0], &rr[0]};
+    return sphereKernels().any(s, first, count, r, tmin * r.length,
+                               tmax * r.length);
+}
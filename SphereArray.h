@@ -0,0 +1,108 @@
+#if !defined(_SPHERE_ARRAY_H_)
+
+#define _SPHERE_ARRAY_H_
+
+#include <vector>
+
+#include "AlignedAllocator.h"
+#include "GeomLib.h"
+
+class Sphere;
+
+//
+// A ray as the sphere kernels take it: its direction scaled to unit
+// length, so that the quadratic of every sphere test has a = 1 and
+// needs a single square root.  Distances along the unit direction are
+// "length" times those along the ray's own.
+//
+struct SphereRay {
+    float org[3];
+    float dir[3];
+    float length;           // of the ray's direction
+    float invLength;
+
+    SphereRay(Ray4& ray);
+};
+
+//
+// The fields of a SphereArray, for the kernels: centers, squared
+// radii.  The arrays go on past the last sphere with NaN centers,
+// which no test ever hits, so that a kernel may load a whole vector
+// from any index.
+//
+struct SphereSlots {
+    const float *cx, *cy, *cz;
+    const float *rr;
+};
+
+//
+// Kernels, one per instruction set: the closest sphere among
+// [first, first + count) with 0 < t < tmax (t along the unit
+// direction), or -1; and whether any has tmin <= t < tmax.  The wide
+// ones are NULL when the binary was built without support for their
+// instruction set (see Makefile.linux).  Which one runs is chosen
+// once, by activeIsa() (see Isa.h).
+//
+typedef int (*SphereHitKernel)(const SphereSlots& s, int first, int count,
+                               const SphereRay& ray, float tmax, float& t);
+typedef bool (*SphereAnyKernel)(const SphereSlots& s, int first, int count,
+                                const SphereRay& ray, float tmin, float tmax);
+
+int sphereFirstHitScalar(const SphereSlots& s, int first, int count,
+                         const SphereRay& ray, float tmax, float& t);
+bool sphereAnyHitScalar(const SphereSlots& s, int first, int count,
+                        const SphereRay& ray, float tmin, float tmax);
+SphereHitKernel sphereSse4Kernel();
+SphereAnyKernel sphereSse4AnyKernel();
+SphereHitKernel sphereAvx2Kernel();
+SphereAnyKernel sphereAvx2AnyKernel();
+SphereHitKernel sphereAvx512Kernel();
+SphereAnyKernel sphereAvx512AnyKernel();
+
+// Name of the kernel in use: "avx512", "avx2", "sse4.2" or "scalar"
+const char *sphereKernelName();
+
+//
+// Spheres stored field by field (structure of arrays), so that a run
+// of them is tested against a ray 4, 8 or 16 at a time.  Filled by
+// PrimitiveList, which gives each leaf's spheres adjacent indices.
+//
+class SphereArray {
+public:
+    //
+    // Take spheres[0] .. spheres[n-1].  Call again after any of them
+    // has moved.
+    //
+    void gather(Sphere * const *spheres, int n);
+
+    int size() const {return (int)owners.size();};
+
+    Sphere *sphere(int i) const {return owners[i];};
+
+    //
+    // The closest of spheres first .. first+count-1 hit by the ray
+    // with t < tmax: its index, with its t (along the ray's own
+    // direction) in "t"; -1 if there is none
+    //
+    int firstHit(int first, int count, const SphereRay& r, float tmax,
+                 float& t) const;
+
+    // true iff one of them is hit with tmin <= t < tmax
+    bool occludes(int first, int count, const SphereRay& r, float tmin,
+                  float tmax) const;
+
+    // Bytes held
+    size_t memoryBytes() const {
+        return cx.capacity() * 4 * sizeof(float) +
+               owners.capacity() * sizeof(Sphere*);
+    };
+
+private:
+    typedef vector<float, AlignedAllocator<float, 64> > FloatArray;
+
+    FloatArray cx, cy, cz;  // centers
+    FloatArray rr;          // radius squared
+    vector<Sphere*> owners;
+};
+
+#endif
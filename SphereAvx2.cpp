@@ -0,0 +1,153 @@
+//////////////////////////////////////////////////////
+//
+// AVX2 sphere kernels: one ray against 8 spheres at a
+// time.  Makefile.linux compiles this file with
+// -mavx2; other builds get no kernel, and SphereArray
+// falls back to the scalar one.
+//
+//////////////////////////////////////////////////////
+
+#include "SphereArray.h"
+
+#if defined(__AVX2__)
+
+#include <immintrin.h>
+
+//
+// One ray in every lane
+//
+struct Avx2SphereRay {
+    __m256 org[3];
+    __m256 dir[3];
+
+    Avx2SphereRay(const SphereRay& r) {
+        for (int a = 0; a < 3; a++) {
+            org[a] = _mm256_set1_ps(r.org[a]);
+            dir[a] = _mm256_set1_ps(r.dir[a]);
+        }
+    }
+
+    // The nearer roots of slots i .. i+7, as sphereFirstHitScalar()
+    // computes them, and in "real" the lanes where they exist
+    inline __m256 nearRoot(const SphereSlots& s, int i, __m256& real) const {
+        __m256 sx = _mm256_sub_ps(org[0], _mm256_loadu_ps(s.cx + i));
+        __m256 sy = _mm256_sub_ps(org[1], _mm256_loadu_ps(s.cy + i));
+        __m256 sz = _mm256_sub_ps(org[2], _mm256_loadu_ps(s.cz + i));
+        __m256 b = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(sx, dir[0]),
+                                               _mm256_mul_ps(sy, dir[1])),
+                                 _mm256_mul_ps(sz, dir[2]));
+        __m256 ss = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(sx, sx),
+                                                _mm256_mul_ps(sy, sy)),
+                                  _mm256_mul_ps(sz, sz));
+        __m256 c = _mm256_sub_ps(ss, _mm256_loadu_ps(s.rr + i));
+        __m256 d = _mm256_sub_ps(_mm256_mul_ps(b, b), c);
+
+        // Empty slots are NaN, and fail this as misses do
+        real = _mm256_cmp_ps(d, _mm256_setzero_ps(), _CMP_GE_OQ);
+        __m256 root = _mm256_sqrt_ps(_mm256_max_ps(d, _mm256_setzero_ps()));
+        __m256 minusB = _mm256_xor_ps(b, _mm256_set1_ps(-0.0f));
+        return _mm256_sub_ps(minusB, root);
+    }
+};
+
+// Slots i .. i+7
+static inline __m256i slotsFrom(int i)
+{
+    return _mm256_add_epi32(_mm256_set1_epi32(i),
+                            _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+}
+
+// The lanes of "slot" below "end"
+static inline __m256 slotsBelow(__m256i slot, int end)
+{
+    return _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(end), slot));
+}
+
+static int sphereFirstHitAvx2(const SphereSlots& s, int first, int count,
+                              const SphereRay& r, float tmax, float& t)
+{
+    Avx2SphereRay ray(r);
+    const __m256 zero = _mm256_setzero_ps();
+    __m256 bestT = _mm256_set1_ps(tmax);
+    __m256i bestSlot = _mm256_set1_epi32(-1);
+    int end = first + count;
+
+    for (int i = first; i < end; i += 8) {
+        __m256 real;
+        __m256 tNear = ray.nearRoot(s, i, real);
+        __m256i slot = slotsFrom(i);
+        __m256 hit = _mm256_and_ps(real, slotsBelow(slot, end));
+        hit = _mm256_and_ps(hit, _mm256_cmp_ps(tNear, zero, _CMP_GT_OQ));
+        hit = _mm256_and_ps(hit, _mm256_cmp_ps(tNear, bestT, _CMP_LT_OQ));
+        if (_mm256_movemask_ps(hit) == 0)
+            continue;
+
+        bestT = _mm256_blendv_ps(bestT, tNear, hit);
+        bestSlot = _mm256_castps_si256(
+                       _mm256_blendv_ps(_mm256_castsi256_ps(bestSlot),
+                                        _mm256_castsi256_ps(slot), hit));
+    }
+
+    // The nearest of the lanes' bests; the lowest slot on a tie, as
+    // the scalar kernel picks it
+    float laneT[8];
+    int laneSlot[8];
+    _mm256_storeu_ps(laneT, bestT);
+    _mm256_storeu_si256((__m256i *)laneSlot, bestSlot);
+    int best = -1;
+    for (int k = 0; k < 8; k++) {
+        if (laneSlot[k] < 0)
+            continue;
+        if (best < 0 || laneT[k] < t || (laneT[k] == t && laneSlot[k] < best)) {
+            t = laneT[k];
+            best = laneSlot[k];
+        }
+    }
+    return best;
+}
+
+static bool sphereAnyHitAvx2(const SphereSlots& s, int first, int count,
+                             const SphereRay& r, float tmin, float tmax)
+{
+    Avx2SphereRay ray(r);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 lo = _mm256_set1_ps(tmin);
+    const __m256 hi = _mm256_set1_ps(tmax);
+    int end = first + count;
+
+    for (int i = first; i < end; i += 8) {
+        __m256 real;
+        __m256 tNear = ray.nearRoot(s, i, real);
+        __m256 hit = _mm256_and_ps(real, slotsBelow(slotsFrom(i), end));
+        hit = _mm256_and_ps(hit, _mm256_cmp_ps(tNear, zero, _CMP_GT_OQ));
+        hit = _mm256_and_ps(hit, _mm256_cmp_ps(tNear, lo, _CMP_GE_OQ));
+        hit = _mm256_and_ps(hit, _mm256_cmp_ps(tNear, hi, _CMP_LT_OQ));
+        if (_mm256_movemask_ps(hit) != 0)
+            return true;
+    }
+    return false;
+}
+
+SphereHitKernel sphereAvx2Kernel()
+{
+    return sphereFirstHitAvx2;
+}
+
+SphereAnyKernel sphereAvx2AnyKernel()
+{
+    return sphereAnyHitAvx2;
+}
+
+#else
+
+SphereHitKernel sphereAvx2Kernel()
+{
+    return NULL;
+}
+
+SphereAnyKernel sphereAvx2AnyKernel()
+{
+    return NULL;
+}
+
+#endif
@@ -0,0 +1,149 @@
+//////////////////////////////////////////////////////
+//
+// AVX-512 sphere kernels: one ray against 16 spheres
+// at a time.  Makefile.linux compiles this file with
+// -mavx512f; other builds get no kernel, and
+// SphereArray falls back to a narrower one.
+//
+//////////////////////////////////////////////////////
+
+#include "SphereArray.h"
+
+#if defined(__AVX512F__)
+
+#include <immintrin.h>
+
+//
+// One ray in every lane
+//
+struct Avx512SphereRay {
+    __m512 org[3];
+    __m512 dir[3];
+
+    Avx512SphereRay(const SphereRay& r) {
+        for (int a = 0; a < 3; a++) {
+            org[a] = _mm512_set1_ps(r.org[a]);
+            dir[a] = _mm512_set1_ps(r.dir[a]);
+        }
+    }
+
+    // The nearer roots of slots i .. i+15, as sphereFirstHitScalar()
+    // computes them, and in "real" the lanes where they exist
+    inline __m512 nearRoot(const SphereSlots& s, int i, __mmask16& real) const {
+        __m512 sx = _mm512_sub_ps(org[0], _mm512_loadu_ps(s.cx + i));
+        __m512 sy = _mm512_sub_ps(org[1], _mm512_loadu_ps(s.cy + i));
+        __m512 sz = _mm512_sub_ps(org[2], _mm512_loadu_ps(s.cz + i));
+        __m512 b = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(sx, dir[0]),
+                                               _mm512_mul_ps(sy, dir[1])),
+                                 _mm512_mul_ps(sz, dir[2]));
+        __m512 ss = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(sx, sx),
+                                                _mm512_mul_ps(sy, sy)),
+                                  _mm512_mul_ps(sz, sz));
+        __m512 c = _mm512_sub_ps(ss, _mm512_loadu_ps(s.rr + i));
+        __m512 d = _mm512_sub_ps(_mm512_mul_ps(b, b), c);
+
+        // Empty slots are NaN, and fail this as misses do
+        real = _mm512_cmp_ps_mask(d, _mm512_setzero_ps(), _CMP_GE_OQ);
+        __m512 root = _mm512_maskz_sqrt_ps(real, d);
+        __m512 minusB = _mm512_castsi512_ps(
+                            _mm512_xor_si512(_mm512_castps_si512(b),
+                                             _mm512_set1_epi32(0x80000000)));
+        return _mm512_sub_ps(minusB, root);
+    }
+};
+
+// The lanes of slots i .. i+15 below "end"
+static inline __mmask16 slotsBelow(int i, int end)
+{
+    int n = end - i;
+    return (n >= 16) ? (__mmask16)0xffff : (__mmask16)((1u << n) - 1);
+}
+
+static int sphereFirstHitAvx512(const SphereSlots& s, int first, int count,
+                                const SphereRay& r, float tmax, float& t)
+{
+    Avx512SphereRay ray(r);
+    const __m512 zero = _mm512_setzero_ps();
+    const __m512i lane = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7,
+                                           8, 9, 10, 11, 12, 13, 14, 15);
+    __m512 bestT = _mm512_set1_ps(tmax);
+    __m512i bestSlot = _mm512_set1_epi32(-1);
+    int end = first + count;
+
+    for (int i = first; i < end; i += 16) {
+        __mmask16 real;
+        __m512 tNear = ray.nearRoot(s, i, real);
+        __mmask16 hit = real & slotsBelow(i, end);
+        hit = _mm512_mask_cmp_ps_mask(hit, tNear, zero, _CMP_GT_OQ);
+        hit = _mm512_mask_cmp_ps_mask(hit, tNear, bestT, _CMP_LT_OQ);
+        if (hit == 0)
+            continue;
+
+        __m512i slot = _mm512_add_epi32(_mm512_set1_epi32(i), lane);
+        bestT = _mm512_mask_blend_ps(hit, bestT, tNear);
+        bestSlot = _mm512_mask_blend_epi32(hit, bestSlot, slot);
+    }
+
+    // The nearest of the lanes' bests; the lowest slot on a tie, as
+    // the scalar kernel picks it
+    float laneT[16];
+    int laneSlot[16];
+    _mm512_storeu_ps(laneT, bestT);
+    _mm512_storeu_si512(laneSlot, bestSlot);
+    int best = -1;
+    for (int k = 0; k < 16; k++) {
+        if (laneSlot[k] < 0)
+            continue;
+        if (best < 0 || laneT[k] < t || (laneT[k] == t && laneSlot[k] < best)) {
+            t = laneT[k];
+            best = laneSlot[k];
+        }
+    }
+    return best;
+}
+
+static bool sphereAnyHitAvx512(const SphereSlots& s, int first, int count,
+                               const SphereRay& r, float tmin, float tmax)
+{
+    Avx512SphereRay ray(r);
+    const __m512 zero = _mm512_setzero_ps();
+    const __m512 lo = _mm512_set1_ps(tmin);
+    const __m512 hi = _mm512_set1_ps(tmax);
+    int end = first + count;
+
+    for (int i = first; i < end; i += 16) {
+        __mmask16 real;
+        __m512 tNear = ray.nearRoot(s, i, real);
+        __mmask16 hit = real & slotsBelow(i, end);
+        hit = _mm512_mask_cmp_ps_mask(hit, tNear, zero, _CMP_GT_OQ);
+        hit = _mm512_mask_cmp_ps_mask(hit, tNear, lo, _CMP_GE_OQ);
+        hit = _mm512_mask_cmp_ps_mask(hit, tNear, hi, _CMP_LT_OQ);
+        if (hit != 0)
+            return true;
+    }
+    return false;
+}
+
+SphereHitKernel sphereAvx512Kernel()
+{
+    return sphereFirstHitAvx512;
+}
+
+SphereAnyKernel sphereAvx512AnyKernel()
+{
+    return sphereAnyHitAvx512;
+}
+
+#else
+
+SphereHitKernel sphereAvx512Kernel()
+{
+    return NULL;
+}
+
+SphereAnyKernel sphereAvx512AnyKernel()
+{
+    return NULL;
+}
+
+#endif
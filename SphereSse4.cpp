@@ -0,0 +1,152 @@
+//////////////////////////////////////////////////////
+//
+// SSE4.2 sphere kernels: one ray against 4 spheres at a
+// time, for processors without AVX2.  Makefile.linux
+// compiles this file with -msse4.2; other builds get no
+// kernel, and SphereArray falls back to the scalar one.
+//
+//////////////////////////////////////////////////////
+
+#include "SphereArray.h"
+
+#if defined(__SSE4_2__)
+
+#include <smmintrin.h>
+
+//
+// One ray in every lane
+//
+struct Sse4SphereRay {
+    __m128 org[3];
+    __m128 dir[3];
+
+    Sse4SphereRay(const SphereRay& r) {
+        for (int a = 0; a < 3; a++) {
+            org[a] = _mm_set1_ps(r.org[a]);
+            dir[a] = _mm_set1_ps(r.dir[a]);
+        }
+    }
+
+    // The nearer roots of slots i .. i+3, as sphereFirstHitScalar()
+    // computes them, and in "real" the lanes where they exist
+    inline __m128 nearRoot(const SphereSlots& s, int i, __m128& real) const {
+        __m128 sx = _mm_sub_ps(org[0], _mm_loadu_ps(s.cx + i));
+        __m128 sy = _mm_sub_ps(org[1], _mm_loadu_ps(s.cy + i));
+        __m128 sz = _mm_sub_ps(org[2], _mm_loadu_ps(s.cz + i));
+        __m128 b = _mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, dir[0]),
+                                         _mm_mul_ps(sy, dir[1])),
+                              _mm_mul_ps(sz, dir[2]));
+        __m128 ss = _mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, sx),
+                                          _mm_mul_ps(sy, sy)),
+                               _mm_mul_ps(sz, sz));
+        __m128 c = _mm_sub_ps(ss, _mm_loadu_ps(s.rr + i));
+        __m128 d = _mm_sub_ps(_mm_mul_ps(b, b), c);
+
+        // Empty slots are NaN, and fail this as misses do
+        real = _mm_cmpge_ps(d, _mm_setzero_ps());
+        __m128 root = _mm_sqrt_ps(_mm_max_ps(d, _mm_setzero_ps()));
+        __m128 minusB = _mm_xor_ps(b, _mm_set1_ps(-0.0f));
+        return _mm_sub_ps(minusB, root);
+    }
+};
+
+// Slots i .. i+3
+static inline __m128i slotsFrom(int i)
+{
+    return _mm_add_epi32(_mm_set1_epi32(i), _mm_setr_epi32(0, 1, 2, 3));
+}
+
+// The lanes of "slot" below "end"
+static inline __m128 slotsBelow(__m128i slot, int end)
+{
+    return _mm_castsi128_ps(_mm_cmpgt_epi32(_mm_set1_epi32(end), slot));
+}
+
+static int sphereFirstHitSse4(const SphereSlots& s, int first, int count,
+                              const SphereRay& r, float tmax, float& t)
+{
+    Sse4SphereRay ray(r);
+    const __m128 zero = _mm_setzero_ps();
+    __m128 bestT = _mm_set1_ps(tmax);
+    __m128i bestSlot = _mm_set1_epi32(-1);
+    int end = first + count;
+
+    for (int i = first; i < end; i += 4) {
+        __m128 real;
+        __m128 tNear = ray.nearRoot(s, i, real);
+        __m128i slot = slotsFrom(i);
+        __m128 hit = _mm_and_ps(real, slotsBelow(slot, end));
+        hit = _mm_and_ps(hit, _mm_cmpgt_ps(tNear, zero));
+        hit = _mm_and_ps(hit, _mm_cmplt_ps(tNear, bestT));
+        if (_mm_movemask_ps(hit) == 0)
+            continue;
+
+        bestT = _mm_blendv_ps(bestT, tNear, hit);
+        bestSlot = _mm_castps_si128(
+                       _mm_blendv_ps(_mm_castsi128_ps(bestSlot),
+                                     _mm_castsi128_ps(slot), hit));
+    }
+
+    // The nearest of the lanes' bests; the lowest slot on a tie, as
+    // the scalar kernel picks it
+    float laneT[4];
+    int laneSlot[4];
+    _mm_storeu_ps(laneT, bestT);
+    _mm_storeu_si128((__m128i *)laneSlot, bestSlot);
+    int best = -1;
+    for (int k = 0; k < 4; k++) {
+        if (laneSlot[k] < 0)
+            continue;
+        if (best < 0 || laneT[k] < t || (laneT[k] == t && laneSlot[k] < best)) {
+            t = laneT[k];
+            best = laneSlot[k];
+        }
+    }
+    return best;
+}
+
+static bool sphereAnyHitSse4(const SphereSlots& s, int first, int count,
+                             const SphereRay& r, float tmin, float tmax)
+{
+    Sse4SphereRay ray(r);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 lo = _mm_set1_ps(tmin);
+    const __m128 hi = _mm_set1_ps(tmax);
+    int end = first + count;
+
+    for (int i = first; i < end; i += 4) {
+        __m128 real;
+        __m128 tNear = ray.nearRoot(s, i, real);
+        __m128 hit = _mm_and_ps(real, slotsBelow(slotsFrom(i), end));
+        hit = _mm_and_ps(hit, _mm_cmpgt_ps(tNear, zero));
+        hit = _mm_and_ps(hit, _mm_cmpge_ps(tNear, lo));
+        hit = _mm_and_ps(hit, _mm_cmplt_ps(tNear, hi));
+        if (_mm_movemask_ps(hit) != 0)
+            return true;
+    }
+    return false;
+}
+
+SphereHitKernel sphereSse4Kernel()
+{
+    return sphereFirstHitSse4;
+}
+
+SphereAnyKernel sphereSse4AnyKernel()
+{
+    return sphereAnyHitSse4;
+}
+
+#else
+
+SphereHitKernel sphereSse4Kernel()
+{
+    return NULL;
+}
+
+SphereAnyKernel sphereSse4AnyKernel()
+{
+    return NULL;
+}
+
+#endif
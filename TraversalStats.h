@@ -0,0 +1,24 @@
+#if !defined(_TRAVERSAL_STATS_H_)
+
+#define _TRAVERSAL_STATS_H_
+
+//
+// Work done by an acceleration structure's closest-hit queries since
+// the last reset: rays traced, nodes (or grid cells) visited and
+// primitive intersection tests made.  A packet of rays counts each of
+// its rays, but its node visits and primitive tests once.
+//
+struct TraversalStats {
+    long long rays;
+    long long nodes;
+    long long prims;
+
+    TraversalStats() : rays(0), nodes(0), prims(0) {}
+
+    void reset() {rays = 0; nodes = 0; prims = 0;};
+
+    double nodesPerRay() const {return (rays > 0) ? (double)nodes / rays : 0;};
+    double primsPerRay() const {return (rays > 0) ? (double)prims / rays : 0;};
+};
+
+#endif
@@ -0,0 +1,256 @@
+//
+// Treelet restructuring (Karras and Aila, "Fast Parallel Construction
+// of High-Quality Bounding Volume Hierarchies", HPG 2013).
+//
+// A pass over a built tree that, bottom-up, takes the node and the
+// largest nodes below it until there are TREELET_SIZE subtrees under
+// it (the treelet's leaves), and rebuilds the few nodes in between
+// with the topology of lowest SAH cost, found by dynamic programming
+// over the subsets of the leaves.  Works on the output of any builder;
+// leaves, and so the primitive order, are left as they are.
+//
+// Restructuring a treelet only touches the node pairs inside it, so
+// separate subtrees are optimized on separate threads, and the few
+// nodes above them afterwards.
+//
+
+#include "BVH.h"
+#include "Parallel.h"
+
+#include <atomic>
+#include <cfloat>
+#include <chrono>
+#include <thread>
+
+// Relative costs of one traversal step and one primitive test,
+// as in BVH.cpp
+static const float TRAVERSAL_COST = 1.0f;
+static const float INTERSECT_COST = 1.0f;
+
+// Traversal stack depth, as in BVH.cpp; restructuring never makes the
+// tree deeper than this
+static const int STACK_SIZE = 128;
+
+// Leaves per treelet: 2^7 subsets to search, as in the paper
+static const int TREELET_SIZE = 7;
+static const int SUBSETS = 1 << TREELET_SIZE;
+
+// The subtrees this deep are optimized in parallel (up to 64 of them)
+static const int TASK_DEPTH = 6;
+
+// Smaller trees are optimized on the calling thread
+static const int PARALLEL_NODES = 8192;
+
+// Passes stop early once one gains less than this fraction of the cost
+static const float MIN_GAIN = 0.001f;
+
+/////////////////////////////////////////////////////////////////////////
+// Optimize the tree with up to "passes" rounds of treelet
+// restructuring
+/////////////////////////////////////////////////////////////////////////
+void BVH::optimize(int passes)
+{
+    if (nodes.size() < 3 || passes <= 0)
+        return;
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    unoptimizedCost = sahCost();
+    float previous = unoptimizedCost;
+
+    // Subtree cost (not divided by the root's area) and height of
+    // every node
+    vector<float> cost(nodes.size());
+    vector<int> height(nodes.size());
+
+    for (int pass = 0; pass < passes; pass++) {
+        vector<int> tasks;
+        if ((int)nodes.size() >= PARALLEL_NODES && workerCount() > 1)
+            collectSubtrees(0, 0, tasks);
+
+        if (!tasks.empty()) {
+            atomic<int> next(0);
+            vector<thread> workers;
+            for (int w = 0; w < workerCount(); w++)
+                workers.push_back(thread([&]() {
+                    int t;
+                    while ((t = next++) < (int)tasks.size())
+                        optimizeNode(tasks[t], TASK_DEPTH, -1, cost, height);
+                }));
+            for (int w = 0; w < (int)workers.size(); w++)
+                workers[w].join();
+            optimizeNode(0, 0, TASK_DEPTH, cost, height);
+        }
+        else
+            optimizeNode(0, 0, -1, cost, height);
+
+        float now = sahCost();
+        if (now > previous * (1 - MIN_GAIN))
+            break;
+        previous = now;
+    }
+
+    builtCost = sahCost();
+    linkParents();
+    optimizeMillis = chrono::duration<double, milli>(
+                         chrono::steady_clock::now() - start).count();
+}
+
+// The interior nodes TASK_DEPTH below "nodeIndex"
+void BVH::collectSubtrees(int nodeIndex, int depth, vector<int>& tasks) const
+{
+    const BVHNode& node = nodes[nodeIndex];
+    if (node.isLeaf())
+        return;
+    if (depth == TASK_DEPTH) {
+        tasks.push_back(nodeIndex);
+        return;
+    }
+    collectSubtrees(node.first,     depth + 1, tasks);
+    collectSubtrees(node.first + 1, depth + 1, tasks);
+}
+
+/////////////////////////////////////////////////////////////////////////
+// Restructure the subtree at nodes[nodeIndex] bottom-up, and fill in
+// its cost and height.  Nodes at "stopDepth" have been done already.
+/////////////////////////////////////////////////////////////////////////
+void BVH::optimizeNode(int nodeIndex, int depth, int stopDepth,
+                       vector<float>& cost, vector<int>& height)
+{
+    if (depth == stopDepth && !nodes[nodeIndex].isLeaf())
+        return;
+
+    const BVHNode& node = nodes[nodeIndex];
+    float area = node.box.surfaceArea();
+    if (node.isLeaf()) {
+        cost[nodeIndex] = INTERSECT_COST * node.count * area;
+        height[nodeIndex] = 1;
+        return;
+    }
+
+    int left = node.first;
+    optimizeNode(left,     depth + 1, stopDepth, cost, height);
+    optimizeNode(left + 1, depth + 1, stopDepth, cost, height);
+    cost[nodeIndex] = TRAVERSAL_COST * area + cost[left] + cost[left + 1];
+    height[nodeIndex] = 1 + max(height[left], height[left + 1]);
+
+    restructureTreelet(nodeIndex, depth, cost, height);
+}
+
+/////////////////////////////////////////////////////////////////////////
+// Form the treelet rooted at nodes[root] and give it the cheapest
+// topology over its leaves.  The treelet's interior node pairs are
+// reused for the new interior nodes, and the leaf subtrees are moved
+// whole (a node refers to its children by index).
+/////////////////////////////////////////////////////////////////////////
+void BVH::restructureTreelet(int root, int depth, vector<float>& cost,
+                             vector<int>& height)
+{
+    int leaves[TREELET_SIZE];
+    int pairs[TREELET_SIZE - 1];
+    int n = 2;
+    int pairCount = 1;
+    leaves[0] = nodes[root].first;
+    leaves[1] = nodes[root].first + 1;
+    pairs[0] = nodes[root].first;
+
+    // Grow the treelet by opening its largest leaf
+    while (n < TREELET_SIZE) {
+        int best = -1;
+        float bestArea = -1;
+        for (int i = 0; i < n; i++) {
+            const BVHNode& node = nodes[leaves[i]];
+            if (!node.isLeaf() && node.box.surfaceArea() > bestArea) {
+                best = i;
+                bestArea = node.box.surfaceArea();
+            }
+        }
+        if (best < 0)
+            break;
+        int first = nodes[leaves[best]].first;
+        pairs[pairCount++] = first;
+        leaves[best] = first;
+        leaves[n++] = first + 1;
+    }
+    if (n < 3)
+        return;             // two leaves fit together only one way
+
+    // Cheapest topology for every subset of the leaves
+    BBox box[SUBSETS];
+    float best[SUBSETS];
+    int split[SUBSETS];
+    int tall[SUBSETS];
+    int all = (1 << n) - 1;
+
+    for (int i = 0; i < n; i++) {
+        box[1 << i] = nodes[leaves[i]].box;
+        best[1 << i] = cost[leaves[i]];
+        tall[1 << i] = height[leaves[i]];
+    }
+    for (int s = 1; s <= all; s++) {
+        if ((s & (s - 1)) == 0)
+            continue;
+        int low = s & -s;
+        box[s] = box[low];
+        box[s].grow(box[s ^ low]);
+
+        // Each split once: the part holding the lowest leaf goes left
+        best[s] = FLT_MAX;
+        for (int p = (s - 1) & s; p > 0; p = (p - 1) & s) {
+            if (!(p & low))
+                continue;
+            float c = best[p] + best[s ^ p];
+            if (c < best[s]) {
+                best[s] = c;
+                split[s] = p;
+            }
+        }
+        best[s] += TRAVERSAL_COST * box[s].surfaceArea();
+        tall[s] = 1 + max(tall[split[s]], tall[s ^ split[s]]);
+    }
+
+    if (best[all] >= cost[root] * (1 - 1e-6f) ||
+        depth + tall[all] >= STACK_SIZE)
+        return;
+
+    BVHNode leafNode[TREELET_SIZE];
+    float leafCost[TREELET_SIZE];
+    int leafHeight[TREELET_SIZE];
+    for (int i = 0; i < n; i++) {
+        leafNode[i] = nodes[leaves[i]];
+        leafCost[i] = cost[leaves[i]];
+        leafHeight[i] = height[leaves[i]];
+    }
+
+    // Write the new topology top-down; the root keeps its index and
+    // its pair of children
+    int nextPair = 0;
+    int slot[SUBSETS];
+    int todo[TREELET_SIZE];
+    int sp = 0;
+    slot[all] = root;
+    todo[sp++] = all;
+    while (sp > 0) {
+        int s = todo[--sp];
+        int index = slot[s];
+        if ((s & (s - 1)) == 0) {
+            int i = 0;
+            while (s != (1 << i))
+                i++;
+            nodes[index] = leafNode[i];
+            cost[index] = leafCost[i];
+            height[index] = leafHeight[i];
+            continue;
+        }
+        int first = pairs[nextPair++];
+        nodes[index].box = box[s];
+        nodes[index].first = first;
+        nodes[index].count = 0;
+        cost[index] = best[s];
+        height[index] = tall[s];
+        slot[split[s]] = first;
+        slot[s ^ split[s]] = first + 1;
+        todo[sp++] = split[s];
+        todo[sp++] = s ^ split[s];
+    }
+}
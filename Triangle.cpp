@@ -1,58 +1,76 @@
 #include "Triangle.h"
 
-Triangle::Triangle(Point4& v1, Point4& v2, Point4& v3, Material& color)
-    : Object(color) {
+Triangle::Triangle(TrianglePool& p, const Point4& v1, const Point4& v2,
+                   const Point4& v3, int material) {
+    pool = &p;
+    index = pool->add(v1, v2, v3, material);
+}
 
-    	this -> A = v1;
-    	this -> B = v2;
-    	this -> C = v3;
-    	this -> mat = color;
+bool Triangle::intersects(Ray4& ray, Hit& hit) {
+    if (!pool->intersects(index, ray, hit))
+        return false;
+    hit.object = this;
+    hit.part = this;
+    return true;
+}
 
+bool Triangle::occludes(Ray4& ray, float tmin, float tmax) {
+    return pool->occludes(index, ray, tmin, tmax);
+}
 
+void Triangle::intersectsPacket(RayPacket& packet, int first) {
+    pool->intersects(index, packet, first, this);
 }
 
-bool Triangle::intersects(Ray4& ray, Hit& hit) {
-    Point4 S = ray.start;
-	Vector4 V = ray.direction;
-	// The coefficients in the linear system of equation
-    float a = V.X(), b = A.X() - B.X(), c = A.X() - C.X(), k = A.X() - S.X();
-    float d = V.Y(), e = A.Y() - B.Y(), f = A.Y() - C.Y(), l = A.Y() - S.Y();
-    float g = V.Z(), h = A.Z() - B.Z(), j = A.Z() - C.Z(), m = A.Z() - S.Z();
-	// Cramer's rule
-    float denom = Matrix4::det3x3(a,b,c,
-                                  d,e,f,
-                                  g,h,j);
-    float t = Matrix4::det3x3(k,b,c,
-                              l,e,f,
-                              m,h,j) / denom;
-    float u = Matrix4::det3x3(a,k,c,
-                              d,l,f,
-                              g,m,j) / denom;
-    float v = Matrix4::det3x3(a,b,k,
-                              d,e,l,
-                              g,h,m) / denom;
-    Point4 P_triang;
-    Vector4 N_triang;
-    float t_triang = -1;
-
-    if (0 <= u && u <= 1 &&
-        0 <= v && v <= 1 &&
-        0 <= u+v && u+v <= 1 &&
-        0 <= t) {
-        t_triang = t;
-        P_triang = S + t_triang * V;
-        N_triang = ((B - A) ^ (C - A)).normalized();
-
-        hit.hit_point = P_triang;
-        hit.normal = N_triang;
-        hit.material = mat;
-        hit.t = t_triang;
-
-        return true;
-    }
+void Triangle::getSurface(Ray4& ray, const Hit& hit, Surface& surface) {
+    pool->surface(index, ray, hit, surface);
+}
 
-    else
-    {
-    	return false;
+BBox Triangle::bounds() {
+    BBox box;
+    for (int i = 0; i < 3; i++)
+        box.grow(getVertex(i));
+    return box;
+}
+
+//
+// Walk the three edges: each vertex goes to the side(s) it lies on,
+// and each edge crossing the plane adds the crossing point to both.
+//
+void Triangle::splitBounds(const BBox& clip, int axis, float pos,
+                           BBox& left, BBox& right) {
+    Point4 v[3] = {getVertex(0), getVertex(1), getVertex(2)};
+    left = BBox();
+    right = BBox();
+
+    for (int i = 0; i < 3; i++) {
+        const Point4& p = v[i];
+        const Point4& q = v[(i + 1) % 3];
+        float pa = p[axis];
+        float qa = q[axis];
+
+        if (pa <= pos)
+            left.grow(p);
+        if (pa >= pos)
+            right.grow(p);
+
+        if ((pa < pos && qa > pos) || (pa > pos && qa < pos)) {
+            float t = (pos - pa) / (qa - pa);
+            float x[3];
+            for (int a = 0; a < 3; a++)
+                x[a] = p[a] + t * (q[a] - p[a]);
+            x[axis] = pos;
+            Point4 crossing(x[0], x[1], x[2]);
+            left.grow(crossing);
+            right.grow(crossing);
+        }
     }
+
+    left.clip(clip);
+    right.clip(clip);
+}
+
+void Triangle::setVertices(const Point4& v1, const Point4& v2,
+                           const Point4& v3) {
+    pool->setVertices(index, v1, v2, v3);
 }
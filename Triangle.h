@@ -5,16 +5,38 @@
 #include "Object.h"
 #include "GeomLib.h"
 #include "Hit.h"
+#include "TrianglePool.h"
 
-class Triangle : public virtual Object {
+//
+// A triangle as a scene object: its vertices and material are kept in
+// a TrianglePool, and the object only says where.
+//
+class Triangle : public Object {
 public:
-    Triangle(Point4& v1, Point4& v2, Point4& v3, Material& color);
-    void setNormal();
+    Triangle(TrianglePool& pool, const Point4& v1, const Point4& v2,
+             const Point4& v3, int material);
+    ObjectType getType() const {return TRIANGLE;};
     bool intersects(Ray4& ray, Hit& hit);
+    bool occludes(Ray4& ray, float tmin, float tmax);
+    void intersectsPacket(RayPacket& packet, int first);
+    void getSurface(Ray4& ray, const Hit& hit, Surface& surface);
+    BBox bounds();
+    void splitBounds(const BBox& clip, int axis, float pos,
+                     BBox& left, BBox& right);
+
+    // Moving a triangle: call BVH::update() afterwards
+    Point4 getVertex(int i) const {return pool->vertex(index, i);};
+    void setVertices(const Point4& v1, const Point4& v2, const Point4& v3);
+
+    int getMaterial() const {return pool->material(index);};
+
+    // Where it is kept
+    TrianglePool *getPool() const {return pool;};
+    int getIndex() const {return index;};
 
 private:
-    Point4 A,B,C;
-    Material mat;
+    TrianglePool *pool;
+    int index;
 };
 
 #endif
@@ -0,0 +1,372 @@
+#include "TrianglePool.h"
+
+#include <algorithm>
+#include <cmath>
+
+//
+// A ray direction, sheared and scaled for the watertight test so that
+// it becomes the unit vector along the new z axis: kz is its largest
+// axis, and kx, ky the other two in the order that keeps the
+// triangles' winding.  Computed once per ray and reused by every
+// triangle test that follows with the same direction.
+//
+struct ShearedRay {
+    float dir[3];
+    int kx, ky, kz;
+    float sx, sy, sz;
+};
+
+static thread_local ShearedRay shearedRay = {{0, 0, 0}, 0, 1, 2, 0, 0, 0};
+
+static inline const ShearedRay& shear(float dx, float dy, float dz)
+{
+    ShearedRay& r = shearedRay;
+    if (r.dir[0] == dx && r.dir[1] == dy && r.dir[2] == dz)
+        return r;
+
+    r.dir[0] = dx;
+    r.dir[1] = dy;
+    r.dir[2] = dz;
+    float ax = fabsf(dx), ay = fabsf(dy), az = fabsf(dz);
+    r.kz = (ax > ay) ? ((ax > az) ? 0 : 2) : ((ay > az) ? 1 : 2);
+    r.kx = (r.kz + 1) % 3;
+    r.ky = (r.kx + 1) % 3;
+    if (r.dir[r.kz] < 0) {
+        int k = r.kx;
+        r.kx = r.ky;
+        r.ky = k;
+    }
+    r.sx = r.dir[r.kx] / r.dir[r.kz];
+    r.sy = r.dir[r.ky] / r.dir[r.kz];
+    r.sz = 1.0f / r.dir[r.kz];
+    return r;
+}
+
+TrianglePool::TrianglePool()
+{
+    watertight = false;
+}
+
+int TrianglePool::newVertex(const Point4& p)
+{
+    for (int a = 0; a < 3; a++)
+        vertices.push_back(p[a]);
+    uses.push_back(1);
+    return (int)uses.size() - 1;
+}
+
+int TrianglePool::add(const Point4& p1, const Point4& p2, const Point4& p3,
+                      int material)
+{
+    indices.push_back(newVertex(p1));
+    indices.push_back(newVertex(p2));
+    indices.push_back(newVertex(p3));
+    materials.push_back(material);
+    return size() - 1;
+}
+
+void TrianglePool::setVertices(int i, const Point4& p1, const Point4& p2,
+                               const Point4& p3)
+{
+    const Point4 *p[3] = {&p1, &p2, &p3};
+    for (int k = 0; k < 3; k++) {
+        unsigned& v = indices[3 * i + k];
+        if (uses[v] > 1) {
+            uses[v]--;
+            v = newVertex(*p[k]);
+            continue;
+        }
+        for (int a = 0; a < 3; a++)
+            vertices[3 * v + a] = (*p[k])[a];
+    }
+}
+
+Point4 TrianglePool::vertex(int i, int k) const
+{
+    const float *p = corner(i, k);
+    return Point4(p[0], p[1], p[2]);
+}
+
+// Orders vertices by their coordinates
+struct VertexLess {
+    const float *xyz;
+
+    bool operator()(unsigned a, unsigned b) const {
+        const float *p = xyz + 3 * a;
+        const float *q = xyz + 3 * b;
+        if (p[0] != q[0])
+            return p[0] < q[0];
+        if (p[1] != q[1])
+            return p[1] < q[1];
+        return p[2] < q[2];
+    }
+};
+
+/////////////////////////////////////////////////////////////////////////
+// Sort the vertices by their coordinates, so that equal ones end up
+// next to each other, and keep the first of each run of equal ones.
+/////////////////////////////////////////////////////////////////////////
+void TrianglePool::shareVertices()
+{
+    int n = vertexCount();
+    vector<unsigned> order(n);
+    for (int v = 0; v < n; v++)
+        order[v] = v;
+    VertexLess less = {vertices.empty() ? NULL : &vertices[0]};
+    sort(order.begin(), order.end(), less);
+
+    vector<unsigned> merged(n);
+    vector<float> kept;
+    kept.reserve(vertices.size());
+    for (int k = 0; k < n; k++) {
+        unsigned v = order[k];
+        const float *p = &vertices[3 * v];
+        if (k == 0 || !(p[0] == kept[kept.size() - 3] &&
+                        p[1] == kept[kept.size() - 2] &&
+                        p[2] == kept[kept.size() - 1])) {
+            for (int a = 0; a < 3; a++)
+                kept.push_back(vertices[3 * v + a]);
+        }
+        merged[v] = (unsigned)kept.size() / 3 - 1;
+    }
+
+    vector<float>(kept).swap(vertices);
+    vector<int>(vertices.size() / 3, 0).swap(uses);
+    for (int k = 0; k < (int)indices.size(); k++) {
+        indices[k] = merged[indices[k]];
+        uses[indices[k]]++;
+    }
+
+    // Loading is done: give back what the arrays grew by
+    vector<unsigned>(indices).swap(indices);
+    vector<int>(materials).swap(materials);
+}
+
+/////////////////////////////////////////////////////////////////////////
+// Moller-Trumbore: solve start + t * direction = v0 + u * e1 + v * e2.
+// false as soon as u or v is out of range (or the ray is parallel to
+// the triangle, which makes them NaN or infinite).
+/////////////////////////////////////////////////////////////////////////
+inline bool TrianglePool::solve(int i, Ray4& ray, float& t, float& u,
+                                float& v) const
+{
+    const float *p = corner(i, 0);
+    const float *p1 = corner(i, 1);
+    const float *p2 = corner(i, 2);
+    float a[3] = {p1[0] - p[0], p1[1] - p[1], p1[2] - p[2]};
+    float b[3] = {p2[0] - p[0], p2[1] - p[1], p2[2] - p[2]};
+    float dx = ray.direction[0], dy = ray.direction[1], dz = ray.direction[2];
+
+    // P = direction x e2
+    float px = dy * b[2] - dz * b[1];
+    float py = dz * b[0] - dx * b[2];
+    float pz = dx * b[1] - dy * b[0];
+    float invDet = 1.0f / (a[0] * px + a[1] * py + a[2] * pz);
+
+    float sx = ray.start[0] - p[0];
+    float sy = ray.start[1] - p[1];
+    float sz = ray.start[2] - p[2];
+    u = (sx * px + sy * py + sz * pz) * invDet;
+    if (!(u >= 0 && u <= 1))
+        return false;
+
+    // Q = s x e1
+    float qx = sy * a[2] - sz * a[1];
+    float qy = sz * a[0] - sx * a[2];
+    float qz = sx * a[1] - sy * a[0];
+    v = (dx * qx + dy * qy + dz * qz) * invDet;
+    if (!(v >= 0 && u + v <= 1))
+        return false;
+
+    t = (b[0] * qx + b[1] * qy + b[2] * qz) * invDet;
+    return t >= 0;
+}
+
+/////////////////////////////////////////////////////////////////////////
+// Watertight test: move the ray's origin to (0,0,0) and shear space so
+// that the ray runs along +z; then the ray hits the triangle iff the
+// origin lies inside the triangle's projection onto the xy plane,
+// which three 2D edge functions decide.  A point on an edge shared by
+// two triangles gets the same edge value (with opposite sign) from
+// both, so it counts for at least one of them.  Edge values of exactly
+// zero are recomputed in double precision, where they are exact.  The
+// edge values over their sum are the barycentric coordinates.
+/////////////////////////////////////////////////////////////////////////
+inline bool TrianglePool::solveWatertight(int i, Ray4& ray, float& t,
+                                          float& u, float& v) const
+{
+    const ShearedRay& r = shear(ray.direction[0], ray.direction[1],
+                                ray.direction[2]);
+    float org[3] = {ray.start[0], ray.start[1], ray.start[2]};
+    const float *pa = corner(i, 0);
+    const float *pb = corner(i, 1);
+    const float *pc = corner(i, 2);
+
+    float a[3], b[3], c[3];
+    for (int k = 0; k < 3; k++) {
+        a[k] = pa[k] - org[k];
+        b[k] = pb[k] - org[k];
+        c[k] = pc[k] - org[k];
+    }
+
+    float ax = a[r.kx] - r.sx * a[r.kz];
+    float ay = a[r.ky] - r.sy * a[r.kz];
+    float bx = b[r.kx] - r.sx * b[r.kz];
+    float by = b[r.ky] - r.sy * b[r.kz];
+    float cx = c[r.kx] - r.sx * c[r.kz];
+    float cy = c[r.ky] - r.sy * c[r.kz];
+
+    float eu = cx * by - cy * bx;
+    float ev = ax * cy - ay * cx;
+    float ew = bx * ay - by * ax;
+    if (eu == 0 || ev == 0 || ew == 0) {
+        eu = (float)((double)cx * by - (double)cy * bx);
+        ev = (float)((double)ax * cy - (double)ay * cx);
+        ew = (float)((double)bx * ay - (double)by * ax);
+    }
+
+    // Both sides of the triangle count
+    if ((eu < 0 || ev < 0 || ew < 0) && (eu > 0 || ev > 0 || ew > 0))
+        return false;
+    float det = eu + ev + ew;
+    if (det == 0)
+        return false;
+
+    float tScaled = r.sz * (eu * a[r.kz] + ev * b[r.kz] + ew * c[r.kz]);
+    if ((det > 0) ? tScaled < 0 : tScaled > 0)
+        return false;
+    t = tScaled / det;
+    u = ev / det;
+    v = ew / det;
+    return true;
+}
+
+bool TrianglePool::intersects(int i, Ray4& ray, Hit& hit) const
+{
+    float t, u, v;
+    if (watertight ? !solveWatertight(i, ray, t, u, v)
+                   : !solve(i, ray, t, u, v))
+        return false;
+    hit.t = t;
+    hit.u = u;
+    hit.v = v;
+    return true;
+}
+
+bool TrianglePool::occludes(int i, Ray4& ray, float tmin, float tmax) const
+{
+    float t, u, v;
+    if (watertight)
+        return solveWatertight(i, ray, t, u, v) && t >= tmin && t < tmax;
+    return solve(i, ray, t, u, v) && t >= tmin && t < tmax;
+}
+
+int TrianglePool::firstHit(const int *list, int n, Ray4& ray, Hit& hit,
+                           float& tmax) const
+{
+    int best = -1;
+    for (int k = 0; k < n; k++) {
+        float t, u, v;
+        bool h = watertight ? solveWatertight(list[k], ray, t, u, v)
+                            : solve(list[k], ray, t, u, v);
+        if (h && t < tmax) {
+            tmax = t;
+            hit.t = t;
+            hit.u = u;
+            hit.v = v;
+            best = k;
+        }
+    }
+    return best;
+}
+
+bool TrianglePool::occludes(const int *list, int n, Ray4& ray, float tmin,
+                            float tmax) const
+{
+    for (int k = 0; k < n; k++)
+        if (occludes(list[k], ray, tmin, tmax))
+            return true;
+    return false;
+}
+
+/////////////////////////////////////////////////////////////////////////
+// solve() for a packet of rays, in a loop without branches that the
+// compiler vectorizes: the same arithmetic, with the rejections turned
+// into one mask per ray.  The watertight test goes ray by ray.
+/////////////////////////////////////////////////////////////////////////
+void TrianglePool::intersects(int i, RayPacket& packet, int first,
+                              Object *owner) const
+{
+    if (watertight) {
+        for (int k = first; k < packet.size; k++) {
+            Ray4 ray = packet.ray(k);
+            float t, u, v;
+            if (solveWatertight(i, ray, t, u, v) && t < packet.tmax[k]) {
+                packet.tmax[k] = t;
+                packet.status[k] = PACKET_PENDING;
+                packet.object[k] = owner;
+            }
+        }
+        return;
+    }
+
+    const float *v0 = corner(i, 0);
+    const float *v1 = corner(i, 1);
+    const float *v2 = corner(i, 2);
+    const float p0 = v0[0], p1 = v0[1], p2 = v0[2];
+    const float a0 = v1[0] - p0, a1 = v1[1] - p1, a2 = v1[2] - p2;
+    const float b0 = v2[0] - p0, b1 = v2[1] - p1, b2 = v2[2] - p2;
+    int hit[PACKET_MAX_RAYS];
+    int hits = 0;
+
+    for (int k = first; k < packet.size; k++) {
+        float dx = packet.dx[k], dy = packet.dy[k], dz = packet.dz[k];
+
+        float px = dy * b2 - dz * b1;
+        float py = dz * b0 - dx * b2;
+        float pz = dx * b1 - dy * b0;
+        float invDet = 1.0f / (a0 * px + a1 * py + a2 * pz);
+
+        float sx = packet.ox[k] - p0;
+        float sy = packet.oy[k] - p1;
+        float sz = packet.oz[k] - p2;
+        float u = (sx * px + sy * py + sz * pz) * invDet;
+
+        float qx = sy * a2 - sz * a1;
+        float qy = sz * a0 - sx * a2;
+        float qz = sx * a1 - sy * a0;
+        float v = (dx * qx + dy * qy + dz * qz) * invDet;
+        float t = (b0 * qx + b1 * qy + b2 * qz) * invDet;
+
+        int h = (u >= 0) & (u <= 1) & (v >= 0) & (u + v <= 1) &
+                (t >= 0) & (t < packet.tmax[k]);
+        packet.tmax[k] = h ? t : packet.tmax[k];
+        packet.status[k] = h ? (int)PACKET_PENDING : packet.status[k];
+        hit[k] = h;
+        hits |= h;
+    }
+
+    // Most triangles are hit by no ray at all
+    if (hits == 0)
+        return;
+    for (int k = first; k < packet.size; k++)
+        if (hit[k])
+            packet.object[k] = owner;
+}
+
+void TrianglePool::surface(int i, Ray4& ray, const Hit& hit,
+                           Surface& surface) const
+{
+    const float *p = corner(i, 0);
+    const float *p1 = corner(i, 1);
+    const float *p2 = corner(i, 2);
+    float a[3] = {p1[0] - p[0], p1[1] - p[1], p1[2] - p[2]};
+    float b[3] = {p2[0] - p[0], p2[1] - p[1], p2[2] - p[2]};
+    Vector4 n(a[1] * b[2] - a[2] * b[1],
+              a[2] * b[0] - a[0] * b[2],
+              a[0] * b[1] - a[1] * b[0]);
+
+    surface.hit_point = ray.start + hit.t * ray.direction;
+    surface.normal = n.normalized();
+    surface.material = materials[i];
+}
@@ -0,0 +1,126 @@
+#if !defined(_TRIANGLE_POOL_H_)
+
+#define _TRIANGLE_POOL_H_
+
+#include <vector>
+
+#include "GeomLib.h"
+#include "Hit.h"
+#include "RayPacket.h"
+
+//
+// The geometry of every triangle, indexed: one array of vertices
+// (3 floats each), shared by all the triangles that meet at a vertex
+// once shareVertices() has run, and per triangle three 32-bit indices
+// into it and an index into the scene's material list.  A closed mesh
+// has about half as many vertices as triangles, so a triangle takes
+// about 16 + 6 bytes, where its first vertex and two edges took 40.
+// The edges are worked out in each test instead: a few subtractions,
+// for less memory traffic.
+//
+// Rays are tested with the Moller-Trumbore algorithm (Moller and
+// Trumbore, "Fast, Minimum Storage Ray/Triangle Intersection", JGT
+// 1997): one reciprocal per test, and the barycentric rejections come
+// before t is computed.  Its rounding can let a ray slip between two
+// triangles sharing an edge; the watertight test (Woop, Benthin and
+// Wald, "Watertight Ray/Triangle Intersection", JCGT 2013) never does,
+// at some cost in speed.
+//
+class TrianglePool {
+public:
+    TrianglePool();
+
+    //
+    // Add the triangle v1 v2 v3, with vertices of its own until the
+    // next shareVertices(); returns its index
+    //
+    int add(const Point4& v1, const Point4& v2, const Point4& v3,
+            int material);
+
+    //
+    // Move triangle "i": call BVH::update() afterwards.  The triangle
+    // first gets its own copy of any vertex it shares, so that its
+    // neighbours stay where they are.
+    //
+    void setVertices(int i, const Point4& v1, const Point4& v2,
+                     const Point4& v3);
+
+    // Vertex k (0, 1 or 2) of triangle "i"
+    Point4 vertex(int i, int k) const;
+
+    //
+    // Store each vertex once: vertices with the same coordinates are
+    // merged, and the triangles' indices follow.  Call when the scene
+    // is loaded; triangles added later share nothing until the next
+    // call.
+    //
+    void shareVertices();
+
+    int material(int i) const {return materials[i];};
+
+    //
+    // Ray tests of triangle "i", as Object::intersects() and
+    // Object::occludes().  Hits have t >= 0; intersects() fills in t,
+    // u and v, and leaves the object to the caller.
+    //
+    bool intersects(int i, Ray4& ray, Hit& hit) const;
+    bool occludes(int i, Ray4& ray, float tmin, float tmax) const;
+
+    //
+    // The same over the triangles list[0] .. list[n-1]: the closest
+    // hit with t < tmax (filling in t, u and v of "hit", lowering tmax
+    // and returning its position in "list", or -1), or whether any
+    // occludes [tmin, tmax).  One loop, with the tests inlined;
+    // hierarchy leaves and brute force call these (see PrimitiveList).
+    //
+    int firstHit(const int *list, int n, Ray4& ray, Hit& hit,
+                 float& tmax) const;
+    bool occludes(const int *list, int n, Ray4& ray, float tmin,
+                  float tmax) const;
+
+    //
+    // Object::intersectsPacket() of triangle "i", whose object is
+    // "owner": pending hits are noted for "owner"
+    //
+    void intersects(int i, RayPacket& packet, int first,
+                    Object *owner) const;
+
+    // Object::getSurface() of triangle "i": its plane's normal
+    void surface(int i, Ray4& ray, const Hit& hit, Surface& surface) const;
+
+    //
+    // Use the watertight test instead of Moller-Trumbore
+    //
+    void setWatertight(bool on) {watertight = on;};
+    bool isWatertight() const {return watertight;};
+
+    int size() const {return (int)materials.size();};
+    int vertexCount() const {return (int)uses.size();};
+
+    // Bytes held
+    size_t memoryBytes() const {
+        return vertices.capacity() * sizeof(float) +
+               indices.capacity() * sizeof(unsigned) +
+               uses.capacity() * sizeof(int) +
+               materials.capacity() * sizeof(int);
+    };
+
+private:
+    // Vertex k of triangle "i", as 3 floats
+    const float *corner(int i, int k) const {
+        return &vertices[3 * indices[3 * i + k]];
+    };
+    int newVertex(const Point4& p);
+
+    inline bool solve(int i, Ray4& ray, float& t, float& u, float& v) const;
+    inline bool solveWatertight(int i, Ray4& ray, float& t, float& u,
+                                float& v) const;
+
+    vector<float> vertices;     // 3 floats per vertex
+    vector<unsigned> indices;   // 3 vertices per triangle
+    vector<int> uses;           // triangles using each vertex
+    vector<int> materials;      // into the scene's material list
+    bool watertight;
+};
+
+#endif
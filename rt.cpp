@@ -7,12 +7,14 @@
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 
+#include <climits>
 #include <cstdlib>
 #include <cstdio>
 #include <iostream>
 #include <fstream>
 #include <cmath>
 #include <vector>
+#include <chrono>
 
 #include "Camera.h"
 #include "KBUI.h"
@@ -22,9 +24,16 @@
 #include "Material.h"
 #include "Object.h"
 #include "Triangle.h"
+#include "TrianglePool.h"
 #include "Sphere.h"
 #include "Light.h"
 #include "Hit.h"
+#include "Accelerator.h"
+#include "PerfCounter.h"
+#include "Mesh.h"
+#include "Instance.h"
+#include "Isa.h"
+#include "RayPacket.h"
 
 using namespace std;
 
@@ -60,10 +69,52 @@ float clipN = 0;
 
 
 vector<Object*> sceneObjects; // list of object in the scene
+vector<Mesh*> sceneMeshes;    // meshes that "instance" entries place
+int instanceCount = 0;
+
+Accelerator *sceneAccel = NULL; // finds what rays hit; built after readScene()
+string accelName = "bvh";       // --accel=<name> (--brute: "brute")
+AccelOptions accelOptions;      // --build=, --optimize, --bvh-width=, ...
+
+int benchFrames = 0;      // --bench[=N]: render N frames without a window
+bool benchAnimate = false; // --animate: move the objects between bench frames
+int replicate = 1;        // --replicate=N: N^3 shrunken copies of the scene
+long long raysTraced = 0; // camera and shadow rays, for the benchmark
+
+int packetSize = 8;       // --packet=N: camera rays traced in NxN packets
+                          // (0: one at a time)
+RayPacket packet;         // the packet being traced
+vector<Hit> bandHits;     // what the camera rays of a band of rows hit
+double primaryMillis = 0; // time spent finding those hits, for the benchmark
+long long primaryRays = 0;
+
+//
+// --wavefront[=ROWS]: the frame is rendered as streams of rays (see
+// renderWave()) rather than pixel by pixel, waveRows rows at a time
+// (by default few enough for the streams to stay in cache)
+//
+const int WAVE_ROWS = 32;
+bool wavefront = false;
+int waveRows = WAVE_ROWS;
+
+// One ray of the shadow stream: from pixel's hit towards a light
+struct ShadowQuery {
+    Ray4 ray;
+    float lightDistance;
+    int pixel;
+    int light;
+};
+
+vector<Surface> waveSurfaces;     // the surface each pixel's ray hit
+vector<int> hitPixels;            // pixels whose camera ray hit, by material
+vector<ShadowQuery> shadowStream; // a shadow ray per hit pixel and light
+vector<char> shadowBlocked;       // and whether it is blocked
+double wavefrontMillis[4] = {0, 0, 0, 0}; // per stage, for the benchmark
 
 vector<Light> sceneLights; // list of lights in the scene
 
 vector<Material> materials; // list of available materials
+TrianglePool trianglePool; // vertices of every triangle
 
 vector<Hit> hits; // list of available hits
 int hitSize = 10;
@@ -79,6 +130,14 @@ int mouse_x, mouse_y;
 Ray4 Mainray;
 bool shadowOn = false;
 
+// Camera rays find hits up to this far away
+const float CAMERA_TMAX = 1000;
+
+// Shadow rays start on the surface they leave.  Hits on that surface
+// itself (t near 0) count, as they always have; a small positive
+// value here would skip them.
+const float SHADOW_TMIN = 0;
+
 // Forward declarations for functions in this file
 void init_UI();
 void setupCamera();
@@ -88,11 +147,17 @@ Color localIllum(Vector4& V, Vector4& N, Vector4& L,
                  Material& mat, Color& ls);
 float power(float x, int n);
 Hit firstHit(Ray4 &ray);
-Hit shadowray_First_Hit(Ray4 &ray);
+bool shadowRayBlocked(Ray4 &ray, float lightDistance);
+float shadowRayTo(Light &light, Surface &hit, Ray4 &shadowray);
+Color computeIntensity(Ray4 &ray, Surface &hit, const char *lit = NULL);
 void camera_changed(float dummy);
 void reRender();
 Color glossy_color(Ray4 &ray, Hit &hit);
 Color rayColor(int xDCS, int yDCS);
+Color hitColor(Ray4 &ray, Hit &hit);
+void traceBand(int y0, int rows);
+void setPixel(int x, int y, Color c);
+void renderWave(int y0, int rows);
 void render();
 string downcase(const string &s);
 void match(ifstream &file, const string& pattern);
@@ -105,6 +170,11 @@ static void error_callback(int error, const char* description);
 void display();
 static void key_callback(GLFWwindow* window, int key,
                          int scancode, int action, int mods);
+void window_resized(int w, int h);
+void sceneChanged();
+void animateScene(int frame);
+void replicateScene(int n);
+void benchmark(int frames);
 int main(int argc, char *argv[]);
 
 
@@ -236,10 +306,25 @@ float power(float x, int n)
 
 
 
+/////////////////////////////////////////////////////////////////////////
+// The shadow ray from the hit point towards "light"; returns the
+// distance to the light along it
+/////////////////////////////////////////////////////////////////////////
+float shadowRayTo(Light &light, Surface &hit, Ray4 &shadowray)
+{
+    Vector4 L = (light.getLightPos() - hit.hit_point).normalized();
+    shadowray = Ray4(hit.hit_point, L);
+    return (light.getLightPos() - hit.hit_point).length();
+}
+
 /////////////////////////////////////////////////////////////////////////
 // Compute the Phong local illumination color.
+//
+// Each light's shadow ray is traced here, unless "lit" gives the
+// shadow state (shadowOn) to use for each light instead (see
+// renderWave()).
 /////////////////////////////////////////////////////////////////////////
-Color computeIntensity(Ray4 &ray, Hit &hit)
+Color computeIntensity(Ray4 &ray, Surface &hit, const char *lit)
 {
     // Intenstity components
     Color Intensity(0,0,0);
@@ -263,10 +348,11 @@ Color computeIntensity(Ray4 &ray, Hit &hit)
     Color I;
 
     // get the material properties of the hit object
-    ambient = hit.material.getAmbient();
-    diffuse = hit.material.getDiffuse();
-    specular= hit.material.getSpecular();
-    n = hit.material.getShininess();
+    Material &material = materials[hit.material];
+    ambient = material.getAmbient();
+    diffuse = material.getDiffuse();
+    specular= material.getSpecular();
+    n = material.getShininess();
 
     Color IaKa;
 
@@ -274,9 +360,10 @@ Color computeIntensity(Ray4 &ray, Hit &hit)
     // Lights ambient color
     _ambientLight = ambientLight;
 
-    for (auto h : sceneLights)
+    for (int k = 0; k < (int)sceneLights.size(); k++)
     {
-        
+        Light h = sceneLights[k];
+
         L = (h.getLightPos() - hit.hit_point).normalized();  // Vector from hit to light
 
         N = hit.normal;
@@ -288,10 +375,20 @@ Color computeIntensity(Ray4 &ray, Hit &hit)
         float RV = (R * V );
         IaKa = ambientLight ^ ambient_term;
 
-        Ray4 shadowray(hit.hit_point, L);           // shadow ray sent from hit point to Light direction
-        Hit shadowhit = shadowray_First_Hit(shadowray); // compute shadow hit if there is any light cant illuminate in that portion
+        bool lightOn;
+        if (lit == NULL)
+        {
+            Ray4 shadowray;                             // shadow ray sent from hit point to Light direction
+            float lightDistance = shadowRayTo(h, hit, shadowray);
+            shadowRayBlocked(shadowray, lightDistance); // is there anything between the hit point and the light?
+            lightOn = shadowOn;
+        }
+        else
+        {
+            lightOn = lit[k];
+        }
 
-        if((shadowOn))
+        if((lightOn))
         {
             if ((N * L) > 0)
             {
@@ -317,29 +414,21 @@ Color computeIntensity(Ray4 &ray, Hit &hit)
 }
 
 /////////////////////////////////////////////////////////////////////////
-// Find the first object hit by the shadow ray, if any
+// Is anything between the start of the shadow ray and the light,
+// "lightDistance" along it?  Only asks whether there is a blocker:
+// the search stops at the first one and builds no hit record.
 /////////////////////////////////////////////////////////////////////////
-Hit shadowray_First_Hit(Ray4 &ray){
+bool shadowRayBlocked(Ray4 &ray, float lightDistance){
 
-    Hit h;
-    Hit Besthit;
+    raysTraced++;
 
-    float tmin = 1000;
-    for(Object* obj : sceneObjects )
+    if(sceneAccel->anyHit(ray, SHADOW_TMIN, lightDistance))
     {
-        if(obj -> intersects(ray, h) )
-        {
-            if( h.t < tmin )
-            {
-                Besthit = h;
-                tmin = h.t;
-                shadowOn = true;
-            }
-        }
+        shadowOn = true;
+        return true;
     }
 
-
-    return Besthit;
+    return false;
 
 }
 
@@ -350,22 +439,12 @@ Hit shadowray_First_Hit(Ray4 &ray){
 
 Hit firstHit(Ray4 &ray) {
 
-    Hit h;
     Hit Besthit;
 
-    float tmin = 1000;
-    for(Object* obj : sceneObjects )
-    {
-        if(obj -> intersects(ray, h) )
-        {
-            if( h.t < tmin )
-            {
-                Besthit = h;
-                tmin = h.t;
-            }
-        }
-    }
+    float tmin = CAMERA_TMAX;
+    raysTraced++;
 
+    sceneAccel->firstHit(ray, Besthit, tmin);
 
     return Besthit;
 }
@@ -397,16 +476,28 @@ void reRender() {
 /////////////////////////////////////////////////////////////////////////
 Color rayColor(int xDCS, int yDCS) {
 
-    // back ground is black
-    Color background(1, 1, 1);
-
     Ray4 ray;
     setRay(xDCS, yDCS, ray);
     Hit hit = firstHit(Mainray);
 
+    return hitColor(Mainray, hit);
+
+}
+
+/////////////////////////////////////////////////////////////////////////
+// The intensity seen along a camera ray that found "hit": the surface
+// there is looked up only now, for the closest hit
+/////////////////////////////////////////////////////////////////////////
+Color hitColor(Ray4 &ray, Hit &hit) {
+
+    // back ground is black
+    Color background(1, 1, 1);
+
     if(hit.t > 0)
     {
-        return computeIntensity(Mainray, hit);
+        Surface surface;
+        hit.object->getSurface(ray, hit, surface);
+        return computeIntensity(ray, surface);
     }
 
     else
@@ -416,46 +507,251 @@ Color rayColor(int xDCS, int yDCS) {
 
 }
 
+/////////////////////////////////////////////////////////////////////////
+// Find what the camera rays of rows y0 .. y0+rows-1 hit, into
+// bandHits: in packets of packetSize x packetSize pixels, or one ray
+// at a time.
+/////////////////////////////////////////////////////////////////////////
+void traceBand(int y0, int rows) {
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    Ray4 ray;
+
+    bandHits.assign(rows * winWidth, Hit());
+
+    if (packetSize == 0)
+    {
+        for (int y = y0; y < y0 + rows; y++)
+        {
+            for (int x = 0; x < winWidth; x++)
+            {
+                setRay(x, y, ray);
+                bandHits[(y - y0) * winWidth + x] = firstHit(Mainray);
+            }
+        }
+    }
+    else
+    {
+        for (int ty = y0; ty < y0 + rows; ty += packetSize)
+        {
+            int tileRows = min(packetSize, y0 + rows - ty);
+
+            for (int x0 = 0; x0 < winWidth; x0 += packetSize)
+            {
+                int columns = min(packetSize, winWidth - x0);
+
+                packet.clear();
+                for (int y = ty; y < ty + tileRows; y++)
+                {
+                    for (int x = x0; x < x0 + columns; x++)
+                    {
+                        setRay(x, y, ray);
+                        packet.add(Mainray, CAMERA_TMAX,
+                                   &bandHits[(y - y0) * winWidth + x]);
+                    }
+                }
+
+                raysTraced += packet.size;
+                sceneAccel->firstHits(packet);
+                packet.record();
+            }
+        }
+    }
+
+    primaryRays += rows * winWidth;
+    primaryMillis += chrono::duration<double, milli>(
+                         chrono::steady_clock::now() - start).count();
+}
+
+/////////////////////////////////////////////////////////////////////////
+// Store color "c" (clamped to 1) as pixel (x, y) of the image
+/////////////////////////////////////////////////////////////////////////
+void setPixel(int x, int y, Color c) {
+    byte r,g,b;
+    int p = (y*winWidth + x) * 3;
+
+    for(int i = 0; i< 3; i++)
+    {
+        if(c[i] > 1.0f)
+        {
+            c[i] = 1.0f;
+        }
+    }
+
+    r = c[0] * 255;
+    g = c[1] * 255;
+    b = c[2] * 255;
+
+    img[p++] = r;
+    img[p++] = g;
+    img[p] =   b;
+}
+
+/////////////////////////////////////////////////////////////////////////
+// Render rows y0 .. y0+rows-1 as streams of rays:
+//   1. every camera ray is traced (traceBand())
+//   2. the surface each camera ray hit is looked up, and the pixels
+//      whose ray hit something are listed, grouped by material
+//   3. a shadow ray per listed pixel and light is generated, and the
+//      whole stream is traced
+//   4. the listed pixels are shaded, a material at a time
+// Each stage runs one kind of work over many rays, which keeps its
+// code and data in cache.
+//
+// Shading pixel by pixel turns shadowOn on at the first blocked shadow
+// ray in scanline order, for good.  Knowing every shadow ray's result
+// before shading, stage 4 gives each light the state it would have
+// seen there, so the pixels can be shaded in any order.
+/////////////////////////////////////////////////////////////////////////
+void renderWave(int y0, int rows) {
+
+    chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+    int pixels = rows * winWidth;
+    int lights = (int)sceneLights.size();
+    Ray4 ray;
+
+    // 1. The camera stream
+    traceBand(y0, rows);
+
+    chrono::steady_clock::time_point t1 = chrono::steady_clock::now();
+
+    // 2. The surfaces hit, and the pixels that hit sorted (stably) by
+    // material; the background's material is -1
+    waveSurfaces.resize(pixels);
+    vector<int> count(materials.size(), 0);
+    int hitCount = 0;
+    for (int p = 0; p < pixels; p++)
+    {
+        Hit &hit = bandHits[p];
+        Surface &surface = waveSurfaces[p];
+        if (!(hit.t > 0))
+        {
+            surface.material = -1;
+            continue;
+        }
+
+        int x = p % winWidth, y = y0 + p / winWidth;
+        setRay(x, y, ray);
+        hit.object->getSurface(Mainray, hit, surface);
+        count[surface.material]++;
+        hitCount++;
+    }
+
+    vector<int> next(materials.size(), 0);
+    for (int i = 1; i < (int)materials.size(); i++)
+        next[i] = next[i - 1] + count[i - 1];
+    hitPixels.resize(hitCount);
+    for (int p = 0; p < pixels; p++)
+        if (waveSurfaces[p].material >= 0)
+            hitPixels[next[waveSurfaces[p].material]++] = p;
+
+    chrono::steady_clock::time_point t2 = chrono::steady_clock::now();
+
+    // 3. The shadow stream
+    shadowStream.resize(hitPixels.size() * lights);
+    for (int i = 0; i < (int)hitPixels.size(); i++)
+    {
+        for (int l = 0; l < lights; l++)
+        {
+            ShadowQuery &q = shadowStream[i * lights + l];
+            q.pixel = hitPixels[i];
+            q.light = l;
+            q.lightDistance = shadowRayTo(sceneLights[l],
+                                          waveSurfaces[q.pixel], q.ray);
+        }
+    }
+
+    shadowBlocked.resize(shadowStream.size());
+    for (int j = 0; j < (int)shadowStream.size(); j++)
+    {
+        ShadowQuery &q = shadowStream[j];
+        shadowBlocked[j] = sceneAccel->anyHit(q.ray, SHADOW_TMIN,
+                                              q.lightDistance);
+    }
+    raysTraced += shadowStream.size();
+
+    // Where shading in scanline order would have turned shadowOn on
+    long long firstBlocked = LLONG_MAX;
+    for (int j = 0; j < (int)shadowStream.size(); j++)
+    {
+        long long order = (long long)shadowStream[j].pixel * lights +
+                          shadowStream[j].light;
+        if (shadowBlocked[j] && order < firstBlocked)
+            firstBlocked = order;
+    }
+
+    chrono::steady_clock::time_point t3 = chrono::steady_clock::now();
+
+    // 4. Shade: the background first, then the hits by material
+    for (int p = 0; p < pixels; p++)
+    {
+        if (waveSurfaces[p].material < 0)
+        {
+            int x = p % winWidth, y = y0 + p / winWidth;
+            setRay(x, y, ray);
+            setPixel(x, y, hitColor(Mainray, bandHits[p]));
+        }
+    }
+
+    vector<char> lit(max(lights, 1));
+    for (int i = 0; i < (int)hitPixels.size(); i++)
+    {
+        int p = hitPixels[i];
+        for (int l = 0; l < lights; l++)
+            lit[l] = shadowOn || (long long)p * lights + l >= firstBlocked;
+
+        int x = p % winWidth, y = y0 + p / winWidth;
+        setRay(x, y, ray);
+        setPixel(x, y, computeIntensity(Mainray, waveSurfaces[p], &lit[0]));
+    }
+
+    if (firstBlocked != LLONG_MAX)
+        shadowOn = true;
+
+    chrono::steady_clock::time_point t4 = chrono::steady_clock::now();
+    wavefrontMillis[0] += chrono::duration<double, milli>(t1 - t0).count();
+    wavefrontMillis[1] += chrono::duration<double, milli>(t2 - t1).count();
+    wavefrontMillis[2] += chrono::duration<double, milli>(t3 - t2).count();
+    wavefrontMillis[3] += chrono::duration<double, milli>(t4 - t3).count();
+}
+
 /////////////////////////////////////////////////////////////////////////
 //
 // This function actually generates the ray-traced image.
 // This is where main code will go.
+//
+// The camera rays are traced a band of rows at a time, and the band
+// is then shaded pixel by pixel in scanline order, the order the
+// shadow state (shadowOn) has always been carried over in.
 /////////////////////////////////////////////////////////////////////////
 
 void render() {
     int x,y;
-    byte r,g,b;
-    int p = 0;
 
     // actual ray tracer rendering code
 
-    Color c;
-
-    for (y=0; y<winHeight; y++)
+    if (wavefront)
     {
-        for (x=0; x<winWidth; x++)
-        {
-            
-            p = (y*winWidth + x) * 3;
+        for (int y0 = 0; y0 < winHeight; y0 += waveRows)
+            renderWave(y0, min(waveRows, winHeight - y0));
+        return;
+    }
 
-            c= rayColor(x, y);
+    Ray4 ray;
+    int band = max(packetSize, 1);
+
+    for (int y0 = 0; y0 < winHeight; y0 += band)
+    {
+        int rows = min(band, winHeight - y0);
+        traceBand(y0, rows);
 
-            for(int i = 0; i< 3; i++)
+        for (y=y0; y<y0+rows; y++)
+        {
+            for (x=0; x<winWidth; x++)
             {
-                if(c[i] > 1.0f)
-                {
-                    c[i] = 1.0f;
-                }
+                setRay(x, y, ray);
+                setPixel(x, y, hitColor(Mainray, bandHits[(y - y0) * winWidth + x]));
             }
-
-            r = c[0] * 255;
-            g = c[1] * 255;
-            b = c[2] * 255;
-
-            img[p++] = r;
-            img[p++] = g;
-            img[p] =   b;
-
         }
     }
 
@@ -589,8 +885,9 @@ void readLights(ifstream &file)
 
 /////////////////////////////////////////////////////////////////////////
 // Utility function -reads Triangle description from input file
+// into "objects"
 /////////////////////////////////////////////////////////////////////////
-void readTriangle(ifstream &file)
+void readTriangle(ifstream &file, vector<Object*>& objects)
 {
     Point4 v1;
     Point4 v2;
@@ -616,10 +913,7 @@ void readTriangle(ifstream &file)
     file >> word;
     file >> material;
 
-    Material color = materials[material];
-
-
-    sceneObjects.push_back(new Triangle(v1, v2, v3, color));
+    objects.push_back(new Triangle(trianglePool, v1, v2, v3, material));
 
 
 
@@ -652,13 +946,79 @@ void readSphere(ifstream &file)
     file >> word;
     file >> material;
 
-    Material color = materials[material];
 
-    sceneObjects.push_back(new Sphere(center, radius, color));
+    sceneObjects.push_back(new Sphere(center, radius, material));
 
 
 }
 
+/////////////////////////////////////////////////////////////////////////
+// Utility function -reads a shared mesh: "mesh <name> <count>" and then
+// <count> triangles, in the mesh's own coordinates.  They are not scene
+// objects themselves; "instance" entries place copies of the mesh.
+/////////////////////////////////////////////////////////////////////////
+void readMesh(ifstream &file)
+{
+    string name;
+    int count = 0;
+    file >> name >> count;
+
+    vector<Object*> triangles;
+    for (int i = 0; i < count; i++) {
+        string word;
+        file >> word;   // triangle
+        readTriangle(file, triangles);
+    }
+
+    Mesh *mesh = new Mesh(name);
+    for (int i = 0; i < (int)triangles.size(); i++)
+        mesh->add(triangles[i]);
+    mesh->build(accelOptions.bvhMethod, accelOptions.optimizePasses,
+                accelOptions.layout, accelOptions.traversal);
+    sceneMeshes.push_back(mesh);
+}
+
+/////////////////////////////////////////////////////////////////////////
+// Utility function -reads one placement of a mesh: its name, then a
+// translation, rotations about X, Y and Z (in degrees, applied in that
+// order) and a scaling, as in
+//   instance
+//   mesh      tree
+//   translate 1 0 -2
+//   rotate    0 45 0
+//   scale     1 1 1
+/////////////////////////////////////////////////////////////////////////
+void readInstance(ifstream &file)
+{
+    string word;
+    string name;
+    float t[3], r[3], s[3];
+
+    file >> word >> name;
+    file >> word >> t[0] >> t[1] >> t[2];
+    file >> word >> r[0] >> r[1] >> r[2];
+    file >> word >> s[0] >> s[1] >> s[2];
+
+    Mesh *mesh = NULL;
+    for (int i = 0; i < (int)sceneMeshes.size(); i++)
+        if (sceneMeshes[i]->getName() == name)
+            mesh = sceneMeshes[i];
+    if (mesh == NULL) {
+        cerr << "Instance of undefined mesh " << name << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    Matrix4 T, Rx, Ry, Rz, S;
+    T.setToTranslation(t[0], t[1], t[2]);
+    Rx.setToXRotation(r[0]);
+    Ry.setToYRotation(r[1]);
+    Rz.setToZRotation(r[2]);
+    S.setToScaling(s[0], s[1], s[2]);
+
+    sceneObjects.push_back(new Instance(mesh, T * Rz * Ry * Rx * S));
+    instanceCount++;
+}
+
 //////////////////////////////////////////////////////
 //
 // This function reads the scene from the data file,
@@ -749,7 +1109,7 @@ void readScene(char *sceneFile) {
         {
             if( word == "triangle")
             {
-                readTriangle(file);
+                readTriangle(file, sceneObjects);
             }
             else if(word == "sphere")
             {
@@ -758,6 +1118,16 @@ void readScene(char *sceneFile) {
            
         }
 
+        else if (word == "mesh")
+        {
+            readMesh(file);
+        }
+
+        else if (word == "instance")
+        {
+            readInstance(file);
+        }
+
         
     }
 
@@ -905,6 +1275,187 @@ void window_resized(int w, int h)
     reRender();
 }
 
+/////////////////////////////////////////////////////////////////////////
+// Call after objects have moved: let the accelerator catch up with
+// their new positions (refit or rebuild) and redraw.
+/////////////////////////////////////////////////////////////////////////
+void sceneChanged()
+{
+    sceneAccel->update();
+    reRender();
+}
+
+/////////////////////////////////////////////////////////////////////////
+// Move every object a little: spheres bob up and down, and triangles
+// wobble their first vertex, each with its own phase.
+/////////////////////////////////////////////////////////////////////////
+void animateScene(int frame)
+{
+    for (int i = 0; i < (int)sceneObjects.size(); i++) {
+        Vector4 offset(0, 0.01f * sin(0.5f * frame + i), 0);
+
+        Sphere *s = dynamic_cast<Sphere*>(sceneObjects[i]);
+        if (s) {
+            Point4 c = s->getCenter() + offset;
+            s->setCenter(c);
+        }
+
+        Triangle *t = dynamic_cast<Triangle*>(sceneObjects[i]);
+        if (t) {
+            Point4 a = t->getVertex(0) + offset;
+            t->setVertices(a, t->getVertex(1), t->getVertex(2));
+        }
+
+        Instance *inst = dynamic_cast<Instance*>(sceneObjects[i]);
+        if (inst) {
+            Matrix4 move;
+            move.setToTranslation(0, offset.Y(), 0);
+            inst->setTransform(move * inst->getTransform());
+        }
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////
+// Replace the scene objects with an n x n x n lattice of copies of the
+// whole scene, each shrunk n times, that fills the scene's bounding box:
+// the view stays the same while the object count grows n^3 times.
+/////////////////////////////////////////////////////////////////////////
+void replicateScene(int n)
+{
+    if (n <= 1 || sceneObjects.empty())
+        return;
+
+    BBox box;
+    for (int i = 0; i < (int)sceneObjects.size(); i++)
+        box.grow(sceneObjects[i]->bounds());
+    float step[3];
+    for (int a = 0; a < 3; a++)
+        step[a] = (box.hi[a] - box.lo[a]) / n;
+
+    vector<Object*> copies;
+    copies.reserve(sceneObjects.size() * n * n * n);
+    for (int x = 0; x < n; x++)
+    for (int y = 0; y < n; y++)
+    for (int z = 0; z < n; z++) {
+        // Shrink towards box.lo, then move into cell (x, y, z)
+        Matrix4 T, S, L;
+        T.setToTranslation(box.lo[0] + x * step[0],
+                           box.lo[1] + y * step[1],
+                           box.lo[2] + z * step[2]);
+        S.setToScaling(1.0f / n, 1.0f / n, 1.0f / n);
+        L.setToTranslation(-box.lo[0], -box.lo[1], -box.lo[2]);
+        Matrix4 M = T * S * L;
+
+        for (int i = 0; i < (int)sceneObjects.size(); i++) {
+            Object *object = sceneObjects[i];
+
+            Sphere *s = dynamic_cast<Sphere*>(object);
+            if (s) {
+                Float4 c = M * s->getCenter();
+                Point4 center(c.X(), c.Y(), c.Z());
+                copies.push_back(new Sphere(center, s->getRadius() / n,
+                                            s->getMaterial()));
+            }
+
+            Triangle *t = dynamic_cast<Triangle*>(object);
+            if (t) {
+                Point4 v[3];
+                for (int k = 0; k < 3; k++) {
+                    Float4 p = M * t->getVertex(k);
+                    v[k] = Point4(p.X(), p.Y(), p.Z());
+                }
+                copies.push_back(new Triangle(trianglePool, v[0], v[1], v[2],
+                                              t->getMaterial()));
+            }
+
+            Instance *inst = dynamic_cast<Instance*>(object);
+            if (inst) {
+                copies.push_back(new Instance(inst->getMesh(),
+                                              M * inst->getTransform()));
+            }
+        }
+    }
+    instanceCount *= n * n * n;
+    sceneObjects.swap(copies);
+}
+
+/////////////////////////////////////////////////////////////////////////
+// Render the scene "frames" times without opening a window, and
+// report the time per frame and the ray throughput on stderr.
+/////////////////////////////////////////////////////////////////////////
+void benchmark(int frames)
+{
+    window_resized(winWidth, winHeight);
+
+    raysTraced = 0;
+    primaryRays = 0;
+    primaryMillis = 0;
+    for (int i = 0; i < 4; i++)
+        wavefrontMillis[i] = 0;
+    sceneAccel->resetTraversalStats();
+    double updateMs = 0;
+
+    PerfCounter cacheMisses(PerfCounter::CACHE_MISSES);
+    PerfCounter l1Misses(PerfCounter::L1D_READ_MISSES);
+    cacheMisses.start();
+    l1Misses.start();
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    for (int f = 0; f < frames; f++) {
+        if (benchAnimate) {
+            animateScene(f);
+            chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+            sceneChanged();
+            updateMs += chrono::duration<double, milli>(
+                            chrono::steady_clock::now() - t0).count();
+        }
+        render();
+    }
+
+    double ms = chrono::duration<double, milli>(
+                    chrono::steady_clock::now() - start).count();
+    long long misses = cacheMisses.stop();
+    long long l1 = l1Misses.stop();
+
+    cerr << "bench: " << frames << " frames of "
+         << winWidth << "x" << winHeight << ", "
+         << ms / frames << " ms/frame, "
+         << raysTraced / (ms * 1000) << " Mrays/s" << endl;
+
+    cerr << "bench: camera rays ";
+    if (packetSize > 0)
+        cerr << "in " << packetSize << "x" << packetSize << " packets";
+    else
+        cerr << "one at a time";
+    cerr << ", " << primaryRays / (primaryMillis * 1000) << " Mrays/s" << endl;
+
+    if (wavefront)
+        cerr << "bench: wavefront stages, ms/frame: camera rays "
+             << wavefrontMillis[0] / frames << ", sort by material "
+             << wavefrontMillis[1] / frames << ", shadow rays "
+             << wavefrontMillis[2] / frames << ", shading "
+             << wavefrontMillis[3] / frames << endl;
+
+    TraversalStats stats = sceneAccel->traversalStats();
+    cerr << "bench: " << sceneAccel->getName() << ": "
+         << stats.nodesPerRay() << " nodes visited and "
+         << stats.primsPerRay() << " primitives tested per ray" << endl;
+
+    // Whole frames: shading and the frame buffer miss too
+    if (cacheMisses.isAvailable() || l1Misses.isAvailable())
+        cerr << "bench: " << (double)misses / raysTraced
+             << " cache misses and " << (double)l1 / raysTraced
+             << " L1 data read misses per ray" << endl;
+    else
+        cerr << "bench: cache-miss counters not available" << endl;
+
+    if (benchAnimate) {
+        cerr << "bench: " << sceneAccel->getName() << " update "
+             << updateMs / frames << " ms/frame" << endl;
+        sceneAccel->printStats(cerr);
+    }
+}
+
 //////////////////////////////////////////////////////
 //
 // Basically, quit if the user hits "q" or "ESC".
@@ -935,16 +1486,139 @@ static void key_callback(GLFWwindow* window, int key,
 //////////////////////////////////////////////////////
 
 int main(int argc, char *argv[]) {
-    if (argc != 2) {
+    char *sceneFile = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--brute")
+            accelName = "brute";
+        else if (arg.compare(0, 8, "--accel=") == 0)
+            accelName = arg.substr(8);
+        else if (arg == "--build=sweep")
+            accelOptions.bvhMethod = BVH_SWEEP;
+        else if (arg == "--build=binned")
+            accelOptions.bvhMethod = BVH_BINNED;
+        else if (arg == "--build=lbvh")
+            accelOptions.bvhMethod = BVH_LBVH;
+        else if (arg == "--build=sbvh")
+            accelOptions.bvhMethod = BVH_SBVH;
+        else if (arg == "--optimize")
+            accelOptions.optimizePasses = 3;
+        else if (arg.compare(0, 11, "--optimize=") == 0)
+            accelOptions.optimizePasses = max(0, atoi(arg.c_str() + 11));
+        else if (arg == "--layout=build")
+            accelOptions.layout = BVH_LAYOUT_BUILD;
+        else if (arg == "--layout=dfs")
+            accelOptions.layout = BVH_LAYOUT_DFS;
+        else if (arg == "--layout=veb")
+            accelOptions.layout = BVH_LAYOUT_VEB;
+        else if (arg.compare(0, 15, "--split-budget=") == 0)
+            accelOptions.splitBudget = max(0.0, atof(arg.c_str() + 15));
+        else if (arg == "--bvh-width=2")
+            accelOptions.bvhWidth = 2;
+        else if (arg == "--bvh-width=8")
+            accelOptions.bvhWidth = 8;
+        else if (arg == "--compress")
+            accelOptions.compress = true;
+        else if (arg == "--cache")
+            accelOptions.useCache = true;
+        else if (arg.compare(0, 8, "--cache=") == 0) {
+            accelOptions.useCache = true;
+            accelOptions.cacheDir = arg.substr(8);
+        }
+        else if (arg == "--traversal=stack")
+            accelOptions.traversal = BVH_TRAVERSE_STACK;
+        else if (arg == "--traversal=short")
+            accelOptions.traversal = BVH_TRAVERSE_SHORT_STACK;
+        else if (arg == "--traversal=stackless")
+            accelOptions.traversal = BVH_TRAVERSE_STACKLESS;
+        else if (arg == "--watertight")
+            trianglePool.setWatertight(true);
+        else if (arg == "--wavefront")
+            wavefront = true;
+        else if (arg.compare(0, 12, "--wavefront=") == 0) {
+            wavefront = true;
+            waveRows = max(1, atoi(arg.c_str() + 12));
+        }
+        else if (arg.compare(0, 9, "--packet=") == 0)
+            packetSize = min(16, max(0, atoi(arg.c_str() + 9)));
+        else if (arg.compare(0, 12, "--replicate=") == 0)
+            replicate = max(1, atoi(arg.c_str() + 12));
+        else if (arg == "--bench")
+            benchFrames = 1;
+        else if (arg == "--animate")
+            benchAnimate = true;
+        else if (arg.compare(0, 8, "--bench=") == 0)
+            benchFrames = max(1, atoi(arg.c_str() + 8));
+        else if (arg.compare(0, 6, "--isa=") == 0) {
+            IsaLevel isa;
+            if (!isaByName(arg.substr(6), isa)) {
+                sceneFile = NULL;
+                break;
+            }
+            if (!setIsa(isa))
+                cerr << "This processor can't run " << isaName(isa)
+                     << " code; using " << isaName(activeIsa()) << endl;
+        }
+        else if (sceneFile == NULL && arg[0] != '-')
+            sceneFile = argv[i];
+        else {
+            sceneFile = NULL;
+            break;
+        }
+    }
+
+    if (sceneFile != NULL) {
+        accelOptions.sceneFile = sceneFile;
+        sceneAccel = createAccelerator(accelName, accelOptions);
+        if (sceneAccel == NULL)
+            cerr << "Unknown accelerator " << accelName << endl;
+    }
+
+    if (sceneAccel == NULL) {
         std::cerr << "Usage:\n";
-        std::cerr << "  rt <scene_file.txt>\n";
+        std::cerr << "  rt [--brute] [--accel=" << acceleratorNames() << "]"
+                     " [--build=sweep|binned|lbvh|sbvh]"
+                     " [--split-budget=F] [--optimize[=N]]\n"
+                     "     [--layout=build|dfs|veb] [--bvh-width=2|8] [--compress]"
+                     " [--cache[=DIR]]\n"
+                     "     [--traversal=stack|short|stackless] [--watertight]"
+                     " [--packet=N]\n"
+                     "     [--wavefront[=ROWS]] [--replicate=N] [--bench[=N] [--animate]]\n"
+                     "     [--isa=scalar|sse4.2|avx2|avx512] <scene_file.txt>\n";
         char line[100];
         std::cin >> line;
         exit(EXIT_FAILURE);
     }
 
-    readScene(argv[1]);
+    cerr << "Instruction set: " << isaName(activeIsa()) << " (processor: "
+         << isaName(hostIsa()) << ")" << endl;
+    readScene(sceneFile);
+    replicateScene(replicate);
+    trianglePool.shareVertices();
+    if (trianglePool.size() > 0)
+        cerr << "Triangles: " << trianglePool.size() << " sharing "
+             << trianglePool.vertexCount() << " vertices, "
+             << trianglePool.memoryBytes() / 1024.0 << " KB" << endl;
+    if (!sceneMeshes.empty()) {
+        int triangles = 0;
+        for (int i = 0; i < (int)sceneMeshes.size(); i++)
+            triangles += sceneMeshes[i]->size();
+        cerr << "Scene: " << instanceCount << " instances of "
+             << sceneMeshes.size() << " meshes, "
+             << triangles << " mesh triangles" << endl;
+    }
+    sceneAccel->build(sceneObjects);
+    sceneAccel->printStats(cerr);
+    cerr << "Accelerator: " << sceneAccel->getName() << ", "
+         << sceneAccel->buildMillis() << " ms to build, "
+         << sceneAccel->memoryBytes() / 1024.0 << " KB" << endl;
     setupCamera();
+
+    if (benchFrames > 0) {
+        benchmark(benchFrames);
+        exit(EXIT_SUCCESS);
+    }
     
     
     GLFWwindow* window;